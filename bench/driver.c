@@ -0,0 +1,246 @@
+/** @file Измеряет производительность сгенерированного парсера на файле с входными данными и печатает
+    результат одной строкой JSON. Парсер должен быть сгенерирован с опцией `recognizer` и подключается
+    в этот файл целиком, поэтому компилировать нужно только его:
+
+    cc -O2 -I<каталог с peg.h> -DPARSER_SOURCE='"json.c"' driver.c -o json-bench
+
+    Использование: json-bench [-m parse|recognize|edit] [-n повторений] [-g имя] <файл>
+
+    Режим `edit` требует парсера, сгенерированного еще и с опцией `incremental`. Каждое повторение
+    вставляет в документ копию байта в случайном месте и удаляет ее, то есть делает две правки,
+    после каждой из которых документ разбирается заново. Для сравнения столько же раз выполняется
+    полный разбор тех же данных в сессии.
+*/
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__unix__) || defined(__APPLE__)
+#  include <sys/resource.h>
+#  define HAVE_GETRUSAGE
+#endif
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/* Счетчики, которые заполняет парсер. */
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/** Количество вызовов malloc, calloc и realloc. */
+static unsigned long allocations = 0;
+/** Количество откатов текущей позиции назад. */
+static unsigned long backtracks = 0;
+
+static void* countedMalloc(size_t size) { ++allocations; return malloc(size); }
+static void* countedCalloc(size_t count, size_t size) { ++allocations; return calloc(count, size); }
+static void* countedRealloc(void* ptr, size_t size) { ++allocations; return realloc(ptr, size); }
+
+/* stdlib.h уже подключен, поэтому макросы заменят только вызовы функций внутри парсера. */
+#define malloc(size)        countedMalloc(size)
+#define calloc(count, size) countedCalloc(count, size)
+#define realloc(ptr, size)  countedRealloc(ptr, size)
+#define PEG_BACKTRACK(ctx, pos) (backtracks += (ctx)->current != (pos))
+
+#ifndef PARSER_SOURCE
+#  error Define PARSER_SOURCE as the quoted path to the generated parser
+#endif
+#include PARSER_SOURCE
+
+#undef malloc
+#undef calloc
+#undef realloc
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/** Возвращает время в секундах от произвольного момента в прошлом. */
+static double now(void) {
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+/** Возвращает максимальный размер резидентной памяти процесса в килобайтах или 0, если он неизвестен. */
+static long peakRss(void) {
+#ifdef HAVE_GETRUSAGE
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#  ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#  else
+    return usage.ru_maxrss;
+#  endif
+  }
+#endif
+  return 0;
+}
+/** Читает файл целиком. */
+static char* readFile(const char* name, unsigned long* size) {
+  FILE* f = fopen(name, "rb");
+  char* data;
+  long len;
+  if (f == 0) {
+    return 0;
+  }
+  fseek(f, 0, SEEK_END);
+  len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  data = (char*)malloc(len > 0 ? (size_t)len : 1);
+  if (data == 0 || fread(data, 1, (size_t)len, f) != (size_t)len) {
+    free(data);
+    fclose(f);
+    return 0;
+  }
+  fclose(f);
+  *size = (unsigned long)len;
+  return data;
+}
+#ifdef PEG_INCREMENTAL
+/** Делает @a iterations пар правок документа с данными @a data, а затем столько же раз разбирает
+    данные полностью, и печатает среднее время одной правки и одного полного разбора.
+
+@return Ненулевое значение, если документ после правок и полный разбор совпадают и успешны.
+*/
+static int benchEdits(const char* grammar, const char* file, const char* data, unsigned long size, unsigned long iterations) {
+  struct Document* doc = createDocument(data, (unsigned int)size, 0);
+  struct Session* session = createSession(0);
+  struct Result* edited = 0;
+  struct Result* parsed = 0;
+  unsigned long state = 2463534242ul;
+  unsigned long i;
+  double start, editSeconds, parseSeconds;
+  int ok;
+
+  if (doc == 0 || session == 0) {
+    fprintf(stderr, "Out of memory\n");
+    exit(2);
+  }
+  start = now();
+  for (i = 0; i < iterations && size > 0; ++i) {
+    unsigned int offset;
+    char copy;
+    /* xorshift: позиции правок одинаковы от запуска к запуску. */
+    state ^= (state << 13) & 0xFFFFFFFFul;
+    state ^= state >> 17;
+    state ^= (state << 5) & 0xFFFFFFFFul;
+    offset = (unsigned int)(state % size);
+    copy = data[offset];
+    editDocument(doc, offset, 0, &copy, 1);
+    edited = editDocument(doc, offset, 1, "", 0);
+  }
+  editSeconds = now() - start;
+
+  start = now();
+  for (i = 0; i < iterations * 2; ++i) {
+    parsed = parseSession(session, data, (unsigned int)size);
+  }
+  parseSeconds = now() - start;
+
+  ok = edited != 0 && parsed != 0 && !isFailed(edited) && !isFailed(parsed)
+    && edited->region.end.offset == parsed->region.end.offset
+    && countNodes(edited) == countNodes(parsed);
+  printf(
+    "{\"grammar\": \"%s\", \"file\": \"%s\", \"mode\": \"edit\", \"bytes\": %lu, \"iterations\": %lu, "
+    "\"ok\": %s, \"editSeconds\": %.6f, \"reparseSeconds\": %.6f, \"peakRssKb\": %ld}\n",
+    grammar, file, size, iterations, ok ? "true" : "false",
+    editSeconds / (iterations * 2), parseSeconds / (iterations * 2), peakRss()
+  );
+  destroySession(session);
+  destroyDocument(doc);
+  return ok;
+}
+#endif
+
+int main(int argc, char** argv) {
+  const char* mode = "parse";
+  const char* grammar = "";
+  const char* file = 0;
+  unsigned long iterations = 1;
+  unsigned long size = 0;
+  unsigned long nodes = 0;
+  unsigned long i;
+  unsigned int end = 0;
+  unsigned int failPos = 0;
+  int ok = 0;
+  double start, seconds;
+  struct Range input;
+  struct FailInfo failInfo;
+  char* data;
+  int a;
+
+  for (a = 1; a < argc; ++a) {
+    if (strcmp(argv[a], "-m") == 0 && a + 1 < argc) {
+      mode = argv[++a];
+    } else if (strcmp(argv[a], "-n") == 0 && a + 1 < argc) {
+      iterations = strtoul(argv[++a], 0, 10);
+    } else if (strcmp(argv[a], "-g") == 0 && a + 1 < argc) {
+      grammar = argv[++a];
+    } else {
+      file = argv[a];
+    }
+  }
+  if (file == 0 || iterations == 0 || (strcmp(mode, "parse") != 0 && strcmp(mode, "recognize") != 0 && strcmp(mode, "edit") != 0)) {
+    fprintf(stderr, "Usage: %s [-m parse|recognize|edit] [-n iterations] [-g name] <file>\n", argv[0]);
+    return 2;
+  }
+  data = readFile(file, &size);
+  if (data == 0) {
+    fprintf(stderr, "Cannot read %s\n", file);
+    return 2;
+  }
+  input.begin = data;
+  input.end   = data + size;
+
+  if (mode[0] == 'e') {
+#ifdef PEG_INCREMENTAL
+    benchEdits(grammar, file, data, size, iterations);
+    free(data);
+    return 0;
+#else
+    fprintf(stderr, "The parser was generated without the incremental option\n");
+    return 2;
+#endif
+  }
+
+  allocations = 0;
+  backtracks  = 0;
+  start = now();
+  for (i = 0; i < iterations; ++i) {
+    if (mode[0] == 'p') {
+      struct Result* r = parse(&input, 0, 0);
+      ok = !isFailed(r);
+      if (ok) {
+        end = r->region.end.offset;
+        /* Подсчет узлов (функцией из peg-internal.h) в замер не входит. */
+        if (i == 0) {
+          double t = now();
+          nodes = countNodes(r);
+          start += now() - t;
+        }
+      }
+      freeResult(r);
+    } else {
+      ok = recognize(&input, 0, 0, &end, 0);
+    }
+  }
+  seconds = now() - start;
+
+  /* Позиция ошибки нужна и для успешного разбора, не дошедшего до конца данных. */
+  if (!ok || end != size) {
+    recognize(&input, 0, 0, &end, &failInfo);
+    failPos = failInfo.pos.offset;
+    free(failInfo.expected);
+  }
+  printf(
+    "{\"grammar\": \"%s\", \"file\": \"%s\", \"mode\": \"%s\", \"bytes\": %lu, \"iterations\": %lu, "
+    "\"ok\": %s, \"end\": %u, \"failPos\": %u, \"seconds\": %.6f, \"mbPerSec\": %.3f, "
+    "\"nodes\": %lu, \"nodesPerSec\": %.0f, \"mallocs\": %lu, \"backtracks\": %lu, \"peakRssKb\": %ld}\n",
+    grammar, file, mode, size, iterations,
+    ok && end == size ? "true" : "false", end, failPos, seconds,
+    seconds > 0 ? (double)size * iterations / seconds / 1e6 : 0.0,
+    nodes, seconds > 0 ? (double)nodes * iterations / seconds : 0.0,
+    allocations / iterations, backtracks / iterations, peakRss()
+  );
+  free(data);
+  return 0;
+}
@@ -0,0 +1,206 @@
+/// Детерминированные генераторы входных данных для грамматик из каталога grammars. Одни и те же
+/// грамматика, размер и начальное значение всегда дают один и тот же файл.
+///
+/// Использование: node inputs.js <грамматика> <размер> <файл> [начальное значение]
+/// Размер задается в байтах, можно с суффиксом K, M или G (64K, 10M, 1G). Итоговый файл может
+/// быть немного больше, так как последняя запись всегда дописывается целиком.
+var fs = require('fs');
+
+/// Возвращает генератор псевдослучайных чисел (xorshift32) с указанным начальным значением.
+function makeRandom(seed) {
+  var x = (seed >>> 0) || 1;
+  function next() {
+    x ^= x << 13; x >>>= 0;
+    x ^= x >>> 17;
+    x ^= x << 5;  x >>>= 0;
+    return x;
+  }
+  return {
+    /// Возвращает целое число из диапазона [0; n).
+    int: function(n) { return next() % n; },
+    /// Возвращает случайный элемент массива.
+    pick: function(a) { return a[next() % a.length]; },
+    /// Возвращает `true` с вероятностью 1/n.
+    chance: function(n) { return next() % n === 0; },
+  };
+}
+/// Преобразует размер вида `64K` в количество байтов.
+function parseSize(text) {
+  var m = /^(\d+)([KMG]?)$/i.exec(String(text));
+  if (!m) {
+    throw new Error('Invalid size: ' + text);
+  }
+  return parseInt(m[1], 10) * { '': 1, K: 1 << 10, M: 1 << 20, G: 1 << 30 }[m[2].toUpperCase()];
+}
+
+var WORDS = ['alpha', 'beta', 'gamma', 'delta', 'epsilon', 'zeta', 'theta', 'kappa', 'lambda', 'sigma', 'omega'];
+
+function word(rnd) {
+  return rnd.pick(WORDS) + (rnd.chance(3) ? '_' + rnd.int(100) : '');
+}
+function integer(rnd) {
+  return String(rnd.int(2) ? rnd.int(10) : rnd.int(1000000));
+}
+
+/// Генераторы записей для каждой грамматики. Каждый получает генератор случайных чисел и функцию
+/// записи, вызывает `begin` один раз в начале, `record` -- пока не набран нужный размер,
+/// и `end` -- один раз в конце.
+var generators = {
+  json: {
+    begin: function(rnd, write) { write('[\n'); },
+    record: function(rnd, write, index) {
+      function string() {
+        var s = word(rnd);
+        if (rnd.chance(4)) { s += rnd.pick(['\\n', '\\"', '\\\\', '\\u00e9', '\\t']) + word(rnd); }
+        return '"' + s + '"';
+      }
+      function number() {
+        var n = (rnd.chance(4) ? '-' : '') + integer(rnd);
+        if (rnd.chance(3)) { n += '.' + rnd.int(1000); }
+        if (rnd.chance(8)) { n += rnd.pick(['e', 'E']) + rnd.pick(['', '+', '-']) + rnd.int(30); }
+        return n;
+      }
+      function value(depth) {
+        switch (rnd.int(depth > 2 ? 5 : 7)) {
+          case 0: case 1: return string();
+          case 2: case 3: return number();
+          case 4: return rnd.pick(['true', 'false', 'null']);
+          case 5: return object(depth + 1);
+          default: return '[' + list(rnd.int(5), depth + 1).join(', ') + ']';
+        }
+      }
+      function list(n, depth) {
+        var items = [];
+        for (var i = 0; i < n; ++i) { items.push(value(depth)); }
+        return items;
+      }
+      function object(depth) {
+        var members = [];
+        for (var i = 0, n = 1 + rnd.int(6); i < n; ++i) {
+          members.push(string() + ': ' + value(depth));
+        }
+        return '{' + members.join(', ') + '}';
+      }
+      write((index > 0 ? ',\n' : '') + '  ' + object(0));
+    },
+    end: function(rnd, write) { write('\n]\n'); },
+  },
+  csv: {
+    begin: function(rnd, write) { write('id,name,value,comment\n'); },
+    record: function(rnd, write, index) {
+      var fields = [String(index), word(rnd), integer(rnd)];
+      switch (rnd.int(4)) {
+        case 0:  fields.push(''); break;
+        case 1:  fields.push('"' + word(rnd) + ', ' + word(rnd) + '"'); break;
+        case 2:  fields.push('"say ""' + word(rnd) + '""\n' + word(rnd) + '"'); break;
+        default: fields.push(word(rnd) + ' ' + word(rnd));
+      }
+      write(fields.join(',') + (rnd.chance(5) ? '\r\n' : '\n'));
+    },
+    end: function() {},
+  },
+  arithmetic: {
+    begin: function() {},
+    record: function(rnd, write, index) {
+      function term(depth) {
+        switch (rnd.int(depth > 3 ? 3 : 5)) {
+          case 0:  return integer(rnd) + (rnd.chance(3) ? '.' + rnd.int(100) : '');
+          case 1:  return word(rnd);
+          case 2:  return word(rnd) + ' * ' + integer(rnd);
+          case 3:  return '(' + expr(depth + 1, 1 + rnd.int(4)) + ')';
+          default: return word(rnd) + '(' + [expr(depth + 1, 1 + rnd.int(3)), term(depth + 1)].slice(0, 1 + rnd.int(2)).join(', ') + ')';
+        }
+      }
+      function expr(depth, n) {
+        var s = term(depth);
+        for (var i = 1; i < n; ++i) {
+          s += ' ' + rnd.pick(['+', '-', '*', '/', '%']) + ' ' + term(depth);
+        }
+        return s;
+      }
+      write((index > 0 ? ' ' + rnd.pick(['+', '-']) + '\n' : '') + expr(0, 1 + rnd.int(8)));
+    },
+    end: function(rnd, write) { write('\n'); },
+  },
+  config: {
+    begin: function(rnd, write) { write('# generated configuration\n'); },
+    record: function(rnd, write) {
+      function value(depth) {
+        switch (rnd.int(depth > 0 ? 4 : 5)) {
+          case 0:  return rnd.pick(['true', 'false', 'yes', 'no', 'on', 'off', 'none']);
+          case 1:  return (rnd.chance(5) ? '-' : '') + integer(rnd) + rnd.pick(['', '', 'k', 'Mb', 'G']);
+          case 2:  return '"' + word(rnd) + ' ' + word(rnd) + '"';
+          case 3:  return word(rnd);
+          default: return '[' + [value(1), value(1), value(1)].slice(0, rnd.int(4)).join(', ') + ']';
+        }
+      }
+      var s;
+      switch (rnd.int(6)) {
+        case 0:
+          s = '[' + word(rnd) + (rnd.chance(2) ? '.' + word(rnd) : '') + ']';
+          break;
+        case 1:
+          s = rnd.pick(['include', 'import', 'ifdef', 'ifndef', 'if', 'elif', 'else', 'endif', 'define',
+                        'undef', 'enable', 'disable', 'export', 'extern', 'optional', 'option', 'requires',
+                        'require', 'return']) + ' ' + value(0) + (rnd.chance(3) ? ', ' + value(0) : '') + ';';
+          break;
+        case 2:
+          s = '# ' + word(rnd) + ' ' + word(rnd);
+          break;
+        default:
+          // Имена, начинающиеся с ключевых слов, заставляют парсер откатываться.
+          s = (rnd.chance(3) ? rnd.pick(['include', 'if', 'option', 'export']) + '_' : '') + word(rnd) + ' = ' + value(0) + ';';
+      }
+      write(s + '\n');
+    },
+    end: function() {},
+  },
+};
+
+/// Создает файл @a file с входными данными для грамматики @a grammar размером не менее @a size байт.
+function generate(grammar, size, file, seed) {
+  var g = generators[grammar];
+  if (!g) {
+    throw new Error('Unknown grammar: ' + grammar);
+  }
+  var rnd = makeRandom(seed === undefined ? 1 : seed);
+  var fd = fs.openSync(file, 'w');
+  var chunks = [], pending = 0, total = 0;
+  // Данные пишутся блоками, так что даже гигабайтные файлы не держатся в памяти целиком.
+  function flush() {
+    fs.writeSync(fd, chunks.join(''), null, 'latin1');
+    chunks = [];
+    pending = 0;
+  }
+  function write(s) {
+    chunks.push(s);
+    pending += s.length;
+    total += s.length;
+    if (pending >= 1 << 20) {
+      flush();
+    }
+  }
+  g.begin(rnd, write);
+  for (var i = 0; total < size; ++i) {
+    g.record(rnd, write, i);
+  }
+  g.end(rnd, write);
+  flush();
+  fs.closeSync(fd);
+  return total;
+}
+
+module.exports = {
+  grammars:  Object.keys(generators),
+  parseSize: parseSize,
+  generate:  generate,
+};
+
+if (require.main === module) {
+  var args = process.argv.slice(2);
+  if (args.length < 3) {
+    console.error('Usage: node inputs.js <' + Object.keys(generators).join('|') + '> <size> <file> [seed]');
+    process.exit(1);
+  }
+  generate(args[0], parseSize(args[1]), args[2], args[3] === undefined ? undefined : parseInt(args[3], 10));
+}
@@ -0,0 +1,170 @@
+/// Запускает бенчмарки: для каждой грамматики из каталога grammars генерирует парсер на C этим
+/// плагином и парсер на JavaScript самим pegjs, создает входные данные указанных размеров,
+/// измеряет оба парсера на одних и тех же данных и проверяет, что их результаты совпадают.
+/// Результаты дописываются по одному объекту JSON на строку в файл результатов, так что их можно
+/// сравнивать между коммитами.
+///
+/// Использование: node bench/run.js [--grammars json,csv] [--sizes 64K,1M] [--iterations 3]
+///   [--mode parse|recognize|edit] [--options '{"memoize":true}'] [--js-limit 64M] [--cc cc]
+///   [--cflags "-O2"] [--out bench/out] [--results bench/out/results.jsonl] [--seed 1]
+///
+/// В режиме edit парсер генерируется еще и с опцией `incremental` и сравнивается время правки
+/// документа в один байт со временем его полного разбора (см. driver.c).
+///
+/// Нужен pegjs с поддержкой плагинов (см. README), а также компилятор C.
+var fs           = require('fs'),
+    path         = require('path'),
+    childProcess = require('child_process'),
+    PEG          = require('pegjs'),
+    inputs       = require('./inputs'),
+    plugin       = require('../src/generate-c-plugin');
+
+var ROOT = path.resolve(__dirname, '..');
+
+/// Копирует в объект @a target свойства остальных аргументов.
+function extend(target) {
+  for (var i = 1; i < arguments.length; ++i) {
+    for (var k in arguments[i]) if (arguments[i].hasOwnProperty(k)) {
+      target[k] = arguments[i][k];
+    }
+  }
+  return target;
+}
+
+function parseArgs(argv) {
+  var args = {
+    grammars:   inputs.grammars.join(','),
+    sizes:      '64K,1M',
+    iterations: '3',
+    mode:       'parse',
+    options:    '{}',
+    'js-limit': '64M',
+    cc:         process.env.CC || 'cc',
+    cflags:     '-O2',
+    out:        path.join(__dirname, 'out'),
+    seed:       '1',
+  };
+  for (var i = 0; i < argv.length; ++i) {
+    var m = /^--(.+)$/.exec(argv[i]);
+    if (!m || i + 1 >= argv.length) {
+      throw new Error('Invalid argument: ' + argv[i]);
+    }
+    args[m[1]] = argv[++i];
+  }
+  args.results = args.results || path.join(args.out, 'results.jsonl');
+  return args;
+}
+
+/// Генерирует исходный код парсера на C для грамматики и возвращает путь к нему.
+function generateC(name, grammar, options, out) {
+  var ast = PEG.parser.parse(grammar);
+  var config = { parser: PEG.parser, passes: {} };
+  for (var stage in PEG.compiler.passes) {
+    config.passes[stage] = PEG.compiler.passes[stage].slice();
+  }
+  plugin.use(config, options);
+  PEG.compiler.compile(ast, config.passes, extend({ output: 'source' }, options));
+  // Грамматики бенчмарка не содержат действий, поэтому файл всего один.
+  var file = path.join(out, name + '.c');
+  fs.writeFileSync(file, ast.files[ast.files.length - 1]);
+  return file;
+}
+/// Компилирует драйвер бенчмарка вместе с парсером и возвращает путь к исполняемому файлу.
+function compile(name, source, args) {
+  var exe = path.join(args.out, name + '-bench');
+  var cmd = [
+    args.cc, args.cflags,
+    '-I' + JSON.stringify(ROOT),
+    '-DPARSER_SOURCE=' + JSON.stringify(JSON.stringify(source)),
+    JSON.stringify(path.join(__dirname, 'driver.c')),
+    '-o', JSON.stringify(exe),
+  ].join(' ');
+  childProcess.execSync(cmd, { stdio: 'inherit' });
+  return exe;
+}
+/// Измеряет парсер на JavaScript. Данные читаются как latin1, чтобы смещения в символах совпадали
+/// со смещениями в байтах у парсера на C.
+function runJs(parser, file, iterations) {
+  var text = fs.readFileSync(file, 'latin1');
+  var ok = true, failPos = 0;
+  var start = process.hrtime();
+  for (var i = 0; i < iterations; ++i) {
+    try {
+      parser.parse(text);
+    } catch (e) {
+      ok = false;
+      failPos = e.offset !== undefined ? e.offset : e.location.start.offset;
+    }
+  }
+  var t = process.hrtime(start);
+  var seconds = t[0] + t[1] / 1e9;
+  return {
+    ok:       ok,
+    failPos:  failPos,
+    seconds:  seconds,
+    mbPerSec: seconds > 0 ? text.length * iterations / seconds / 1e6 : 0,
+  };
+}
+function gitCommit() {
+  try {
+    return childProcess.execSync('git rev-parse HEAD', { cwd: ROOT }).toString().trim();
+  } catch (e) {
+    return null;
+  }
+}
+
+function main() {
+  var args    = parseArgs(process.argv.slice(2));
+  var options = extend({ recognizer: true }, args.mode === 'edit' ? { incremental: true } : {}, JSON.parse(args.options));
+  var jsLimit = inputs.parseSize(args['js-limit']);
+  var commit  = gitCommit();
+  var failed  = false;
+
+  if (!fs.existsSync(args.out)) {
+    fs.mkdirSync(args.out);
+  }
+  args.grammars.split(',').forEach(function(name) {
+    var grammar = fs.readFileSync(path.join(__dirname, 'grammars', name + '.pegjs'), 'utf8');
+    var exe = compile(name, generateC(name, grammar, options, args.out), args);
+    var jsParser = PEG.buildParser(grammar);
+
+    args.sizes.split(',').forEach(function(size) {
+      var file = path.join(args.out, name + '-' + size + '-' + args.seed + '.txt');
+      var bytes = inputs.parseSize(size);
+      // Входные данные детерминированы, поэтому созданный однажды файл используется повторно.
+      if (!fs.existsSync(file)) {
+        inputs.generate(name, bytes, file, parseInt(args.seed, 10));
+      }
+      var c = JSON.parse(childProcess.execFileSync(exe, ['-m', args.mode, '-n', args.iterations, '-g', name, file]).toString());
+      // Правки парсер на JavaScript не поддерживает.
+      var js = args.mode !== 'edit' && fs.statSync(file).size <= jsLimit ? runJs(jsParser, file, parseInt(args.iterations, 10)) : null;
+      // Парсер на JavaScript требует разбора всех данных, что и означает флаг `ok` у драйвера.
+      var agree = js === null || (c.ok === js.ok && (c.ok || c.failPos === js.failPos));
+      var result = {
+        date:    new Date().toISOString(),
+        commit:  commit,
+        size:    size,
+        seed:    parseInt(args.seed, 10),
+        options: options,
+        c:       c,
+        js:      js,
+        agree:   agree,
+      };
+      fs.appendFileSync(args.results, JSON.stringify(result) + '\n');
+      console.log(
+        args.mode === 'edit'
+        ? name + ' ' + size + ': edit ' + (c.editSeconds * 1e3).toFixed(3) + ' ms, full parse '
+          + (c.reparseSeconds * 1e3).toFixed(3) + ' ms, ' + c.peakRssKb + ' KB RSS'
+          + (c.ok ? '' : '; EDITED DOCUMENT DIFFERS FROM FULL PARSE')
+        : name + ' ' + size + ': C ' + c.mbPerSec.toFixed(1) + ' MB/s, ' + c.mallocs + ' mallocs, '
+        + c.backtracks + ' backtracks, ' + c.peakRssKb + ' KB RSS'
+        + (js ? '; JS ' + js.mbPerSec.toFixed(1) + ' MB/s' : '')
+        + (agree ? '' : '; RESULTS DIFFER (C ok=' + c.ok + ' failPos=' + c.failPos + ', JS ok=' + js.ok + ' failPos=' + js.failPos + ')')
+      );
+      failed = failed || !agree || (args.mode === 'edit' && !c.ok);
+    });
+  });
+  process.exit(failed ? 1 : 0);
+}
+
+main();
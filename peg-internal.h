@@ -9,10 +9,83 @@
 #include <string.h>
 /* Для malloc/calloc/free/bsearch. */
 #include <stdlib.h>
+/* Для CHAR_BIT. */
+#include <limits.h>
 /* Для va_*, используемых в функции wrap. */
 #include <stdarg.h>
 #include <assert.h>
 
+/* Векторные инструкции используются, если компилятор их поддерживает для целевой платформы.
+   Определение макроса PEG_NO_SIMD отключает их и оставляет только переносимый код. */
+#ifndef PEG_NO_SIMD
+#  if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define PEG_SSE2
+#    include <emmintrin.h>
+#  endif
+#  if defined(__AVX2__)
+#    define PEG_AVX2
+#    include <immintrin.h>
+#  endif
+#endif
+
+/* Профилирование правил включается макросом PEG_PROFILE. Без него макросы, которыми размечены
+   функции разбора правил, раскрываются в пустые выражения и ничего не стоят. Время правил
+   измеряется, если определен макрос PEG_PROFILE_CLOCK(), возвращающий показание счетчика типа
+   unsigned long; макрос PEG_PROFILE_CYCLES определяет его как счетчик тактов процессора x86. */
+#ifdef PEG_PROFILE
+#  include <stdio.h>
+#  if defined(PEG_PROFILE_CYCLES) && !defined(PEG_PROFILE_CLOCK)
+#    if defined(_MSC_VER)
+#      include <intrin.h>
+#      define PEG_PROFILE_CLOCK() ((unsigned long)__rdtsc())
+#    elif defined(__i386__) || defined(__x86_64__)
+#      include <x86intrin.h>
+#      define PEG_PROFILE_CLOCK() ((unsigned long)__rdtsc())
+#    endif
+#  endif
+#  ifndef PEG_PROFILE_CLOCK
+#    define PEG_PROFILE_CLOCK() 0ul
+#  endif
+/* Должен быть первым оператором функции правила: объявляет кадр профилирования. */
+#  define PEG_PROFILE_ENTER(ctx, rule) struct ProfileFrame profileFrame; enterRule(ctx, &profileFrame, rule)
+#  define PEG_PROFILE_LEAVE(ctx, result) leaveRule(ctx, &profileFrame, result)
+#  define PEG_PROFILE_MEMO(ctx, hit) profileMemo(ctx, hit)
+#  ifndef PEG_BACKTRACK
+#    define PEG_BACKTRACK(ctx, pos) profileBacktrack(ctx, pos)
+#  endif
+#else
+#  define PEG_PROFILE_ENTER(ctx, rule) ((void)0)
+#  define PEG_PROFILE_LEAVE(ctx, result) ((void)0)
+#  define PEG_PROFILE_MEMO(ctx, hit) ((void)0)
+#endif
+
+/* Отмечает, что разбор прочитал данные до смещения `end` (не включая его). Нужно только
+   инкрементальному разбору, для которого генератор определяет макрос PEG_INCREMENTAL. */
+#ifdef PEG_INCREMENTAL
+#  define PEG_EXAMINE(ctx, end) ((void)((ctx)->examined < (end) && ((ctx)->examined = (end))))
+#else
+#  define PEG_EXAMINE(ctx, end) ((void)0)
+#endif
+/* Результаты правил, прочитавших меньше данных, инкрементальный разбор не запоминает: разобрать
+   их заново не дороже, чем найти в таблице, а без них таблица в разы меньше и быстрее обновляется
+   при правке. */
+#ifndef PEG_MEMO_SPAN
+#  define PEG_MEMO_SPAN 8
+#endif
+/* Отмечает, что разбор сообщил неудачу в текущей позиции. Тоже нужно только инкрементальному
+   разбору: запомненные результаты правил воспроизводят свои неудачи при повторном использовании. */
+#ifdef PEG_INCREMENTAL
+#  define PEG_FAILED(ctx) ((void)((ctx)->failed < (ctx)->current && ((ctx)->failed = (ctx)->current)))
+#else
+#  define PEG_FAILED(ctx) ((void)0)
+#endif
+
+/* Выполняется перед каждым возвратом текущей позиции разбора к ранее запомненной позиции `pos`.
+   Определив макрос до подключения парсера, можно, например, подсчитывать откаты. */
+#ifndef PEG_BACKTRACK
+#  define PEG_BACKTRACK(ctx, pos) ((void)0)
+#endif
+
 struct Literal {
   /** Длина литерала (массива data). */
   unsigned int len;
@@ -21,20 +94,35 @@ struct Literal {
   /** Сообщение об ожидаемом элементе, если сопоставление с литералом пройдет неудачно. */
   /*struct Expected expected;*/
 };
+/** Максимальное количество диапазонов класса символов, проверяемых векторными инструкциями. */
+#define CLASS_RANGES 4
 struct CharClass {
-  /** Старшая половина -- количество элементов в массиве single, младшая -- количество пар
-      в массиве range.
+  /** Битовая карта принадлежности байтов классу: байт `ch` входит в класс, если в элементе
+      `ch / 8` установлен бит `ch % 8`. Инвертирование класса уже учтено в карте.
   */
-  unsigned int counts;
-  /** Массив одиночных символов, включенный в данный набор. */
-  const char* single;
-  /** Массив пар символов (т.е. длина массива всегда четная), представляющих в данном наборе
-      поддиапазоны от первого до посленего символа (обе границы включительно).
+  unsigned char bits[32];
+  /** Количество диапазонов в массиве ranges или 0, если класс состоит из большего числа диапазонов
+      и проверяется только по битовой карте.
   */
-  const char* range;
+  unsigned int count;
+  /** Массив пар байтов, задающих границы (обе включительно) подряд идущих байтов класса. Используется
+      для векторного пропуска последовательностей байтов класса.
+  */
+  unsigned char ranges[CLASS_RANGES * 2];
   /** Сообщение об ожидаемом элементе, если сопоставление с классом символов пройдет неудачно. */
   /*struct Expected expected;*/
 };
+/** Таблица выбора альтернативы по первому байту для выражения выбора. */
+struct Dispatch {
+  /** Для каждого байта и для конца данных (элемент 256) -- номер первой альтернативы, которая
+      может с него начаться, или количество альтернатив, если таких нет.
+  */
+  unsigned char first[257];
+  /** Ожидаемые элементы альтернатив, о которых нужно сообщить, если альтернатива пропущена.
+      Списки альтернатив идут по порядку и заканчиваются нулевым указателем.
+  */
+  const struct Expected* const* expected;
+};
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 /* Вспомогательные структуры. */
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
@@ -49,114 +137,367 @@ struct ParseFunc {
   RuleFunc func;
 };
 
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/* Доступ к данным. */
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/** Дочитывает данные потока в буфер окна, пока после текущей позиции не станет доступно не менее
+    @a count байт. Данные дописываются в конец буфера, поэтому указатели на уже прочитанные данные
+    остаются действительными.
+
+@return Ненулевое значение, если нужное количество байт доступно, 0, если данные переданы целиком,
+        поток закончился или буфер окна заполнен.
+*/
+int refill(struct Context* context, unsigned int count) {
+  struct Stream* s;
+  assert(context);
+
+  s = context->stream;
+  if (s == 0) {
+    return 0;
+  }
+  while ((unsigned int)(context->input.end - context->input.begin) - context->current < count) {
+    unsigned int used;
+    unsigned int n;
+    if (s->eof) {
+      return 0;
+    }
+    used = (unsigned int)(context->input.end - context->input.begin);
+    if (used == s->size) {
+      s->overflow = 1;
+      return 0;
+    }
+    n = (*s->read)(s->source, s->buffer + used, s->size - used);
+    if (n == 0) {
+      s->eof = 1;
+      return 0;
+    }
+    context->input.end += n;
+  }
+  return 1;
+}
+/** Проверяет, что после текущей позиции доступно не менее @a count байт, при необходимости
+    дочитывая их из потока. Без потока сводится к сравнению с концом данных.
+*/
+#define available(context, count) ( \
+  PEG_EXAMINE((context), (context)->current + (count)), \
+  (unsigned int)((context)->input.end - (context)->input.begin) - (context)->current >= (count) \
+  || refill((context), (count)) \
+)
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 /* Процедуры сопоставления. */
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 int matchLiteral(struct Context* context, const struct Literal* literal) {
-  const char* begin;
-  unsigned int inputLen;
-  begin = context->input.begin + context->current.offset;
-  inputLen = context->input.end - begin;
   /* Если входная строка короче, то она точно не равна литералу. */
-  return inputLen < literal->len ? 0 : memcmp(begin, literal->data, literal->len) == 0;
+  return available(context, literal->len)
+    && memcmp(context->input.begin + context->current, literal->data, literal->len) == 0;
 }
+/** Проверяет, входит ли байт @a ch в класс символов @a cls. */
+#define inClass(cls, ch) ((cls)->bits[(unsigned char)(ch) >> 3] & (1 << ((unsigned char)(ch) & 7)))
 /**
 @param context Информация о разбираемом участке и текущей в нем позиции.
-@param ranges Массив из @a count описателей диапазонов символов/списков символов.
-@param count Количество элементов в массиве @a ranges.
+@param cls Класс символов, с которым сопоставляется текущий символ.
+
+@return Ненулевое значение, если текущий символ входит в класс, 0, если не входит или
+        достигнут конец данных.
 */
-int matchCharClass(struct Context* context, struct CharClass* cls, int inverted) {
+int matchCharClass(struct Context* context, const struct CharClass* cls) {
   const char* begin;
   assert(context);
   assert(context->input.begin);
   assert(cls);
-  assert(cls->single);
-  assert(cls->range);
-
-  begin = context->input.begin + context->current.offset;
-
-  /* Если мы еще не в конце входных данных, то пытаемся сматчить текущий символ. */
-  if (begin < context->input.end) {
-    /* Выделяем нижнюю половину бит числа с помощью  маски. Верхнюю половину получаем, просто
-    отодвинув ненужную нижнюю половину. */
-    unsigned int countLO;
-    unsigned int countHI;
-    char ch;
-    unsigned int i;
 
-    countLO = cls->counts & ((~0u) >> (sizeof(cls->counts)*4));
-    countHI = cls->counts >> (sizeof(cls->counts)*4);
-    ch = begin[0];
-    /* Класс символов является списком пар, задающих диапазоны символов. */
-    for (i = 0; i < countLO; ++i) {
-      char b;
-      char e;
-
-      b = cls->range[i*2];
-      e = cls->range[i*2 + 1];
-      /* Строгая проверка, т.к. если начало и конец совпадают, то это единственный символ
-      и он должен быть в cls->single. */
-      assert(b < e);
-      if (b <= ch && ch <= e) {
-        /* Текущий символ принадлежит диапазону символов. */
-        return !inverted;
+  begin = context->input.begin + context->current;
+  return available(context, 1) && inClass(cls, *begin);
+}
+/** Возвращает количество подряд идущих байтов класса @a cls, начиная с @a begin, но не далее @a end.
+    Если класс состоит из небольшого числа диапазонов, байты проверяются блоками по 32 или 16 штук
+    с помощью AVX2 или SSE2, остаток проверяется по битовой карте.
+*/
+unsigned int spanCharClass(const struct CharClass* cls, const char* begin, const char* end) {
+  const char* p = begin;
+  assert(cls);
+  assert(begin <= end);
+
+#ifdef PEG_AVX2
+  if (cls->count > 0) {
+    while (end - p >= 32) {
+      __m256i x = _mm256_loadu_si256((const __m256i*)p);
+      __m256i m = _mm256_setzero_si256();
+      unsigned int i;
+      for (i = 0; i < cls->count; ++i) {
+        /* Байт лежит в диапазоне [lo; hi], если (x - lo) <= (hi - lo) как беззнаковые числа. */
+        __m256i d = _mm256_sub_epi8(x, _mm256_set1_epi8((char)cls->ranges[i*2]));
+        __m256i w = _mm256_set1_epi8((char)(cls->ranges[i*2 + 1] - cls->ranges[i*2]));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_max_epu8(d, w), w));
+      }
+      if ((unsigned int)_mm256_movemask_epi8(m) != 0xFFFFFFFFu) {
+        break;
       }
+      p += 32;
     }
-    /* Класс символов является просто списком символов, которые нужно проверить. */
-    if (memchr(cls->single, ch, countHI) != 0) {
-      /* Если текущий символ строки имеется в списке допустимых символов, сопоставление успешно. */
-      return !inverted;
+  }
+#endif
+#ifdef PEG_SSE2
+  if (cls->count > 0) {
+    while (end - p >= 16) {
+      __m128i x = _mm_loadu_si128((const __m128i*)p);
+      __m128i m = _mm_setzero_si128();
+      unsigned int i;
+      for (i = 0; i < cls->count; ++i) {
+        __m128i d = _mm_sub_epi8(x, _mm_set1_epi8((char)cls->ranges[i*2]));
+        __m128i w = _mm_set1_epi8((char)(cls->ranges[i*2 + 1] - cls->ranges[i*2]));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(d, w), w));
+      }
+      if (_mm_movemask_epi8(m) != 0xFFFF) {
+        break;
+      }
+      p += 16;
     }
   }
-  return inverted;
+#endif
+  /* Блок, в котором нашелся байт не из класса, и короткий хвост проверяем побайтно. */
+  while (p < end && inClass(cls, *p)) {
+    ++p;
+  }
+  return (unsigned int)(p - begin);
 }
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 /* Работа с памятью. */
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-struct Result* allocResult(const char* begin, const char* end, unsigned int count) {
-  struct Result* r = (struct Result*)malloc(sizeof(struct Result));
+/** Размер блока арены по умолчанию. Следующие блоки выделяются вдвое большего размера. */
+#define ARENA_BLOCK_SIZE 65536ul
+/** Выравнивание памяти, выделяемой в арене. */
+#define ARENA_ALIGN(size) (((size) + sizeof(void*) - 1) & ~(unsigned long)(sizeof(void*) - 1))
+/** Выделяет @a size байт в арене. Память не освобождается до отката арены или ее уничтожения. */
+void* allocArena(struct Arena* arena, unsigned long size) {
+  struct ArenaBlock* b;
+  assert(arena);
+
+  size = ARENA_ALIGN(size);
+  b = arena->top;
+  if (b == 0 || arena->used + size > b->base + b->size) {
+    /* Остаток текущего блока пропускается, поэтому новый блок начинается с текущей отметки. */
+    unsigned long blockSize = b ? b->size * 2 : ARENA_BLOCK_SIZE;
+    if (blockSize < size) {
+      blockSize = size;
+    }
+    if (arena->spare && arena->spare->size >= size) {
+      b = arena->spare;
+      arena->spare = 0;
+    } else {
+      b = (struct ArenaBlock*)malloc(ARENA_ALIGN(sizeof(struct ArenaBlock)) + blockSize);
+      assert(b);
+      b->size = blockSize;
+    }
+    b->prev = arena->top;
+    b->base = arena->used;
+    arena->top = b;
+  }
+  arena->used += size;
+  return (char*)b + ARENA_ALIGN(sizeof(struct ArenaBlock)) + (arena->used - size - b->base);
+}
+/** Возвращает отметку арены контекста, к которой можно будет откатиться при неудаче разбора. */
+unsigned long markArena(struct Context* context) {
+  return context->arena ? context->arena->used : 0;
+}
+/** Освобождает всю память арены контекста, выделенную после отметки @a mark, за исключением
+    памяти, удерживаемой таблицей мемоизации. Если контекст не использует арену, ничего не делает.
+*/
+void rewindArena(struct Context* context, unsigned long mark) {
+  struct Arena* arena = context->arena;
+  if (arena == 0) {
+    return;
+  }
+  if (mark < arena->pin) {
+    mark = arena->pin;
+  }
+  while (arena->top && arena->top->base > mark) {
+    struct ArenaBlock* b = arena->top;
+    arena->top = b->prev;
+    if (arena->spare == 0 || arena->spare->size < b->size) {
+      free(arena->spare);
+      arena->spare = b;
+    } else {
+      free(b);
+    }
+  }
+  if (mark < arena->used) {
+    arena->used = mark;
+  }
+}
+struct Result* allocResult(struct Context* context, const char* begin, const char* end, unsigned int count) {
+  struct Result* r;
+  assert(context);
   assert(begin);
   assert(end);
-  assert(r);
-  r->region.begin.data = begin;
-  r->region.end.data   = end;
+  if (context->arena) {
+    r = (struct Result*)allocArena(context->arena, sizeof(struct Result));
+    r->childs = count == 0 ? 0 : (struct Result**)allocArena(context->arena, count * sizeof(struct Result*));
+    r->refs = 0;
+  } else {
+    r = (struct Result*)malloc(sizeof(struct Result));
+    assert(r);
+    r->childs = count == 0 ? 0 : (struct Result**)calloc(count, sizeof(struct Result*));
+    r->refs = 1;
+  }
+  /* Позиции создаются только здесь: во время разбора отслеживается лишь смещение. Номера строк
+  и столбцов вычисляются по запросу функцией resolveLocation. */
+  r->region.begin.data   = begin;
+  r->region.begin.offset = (unsigned int)(begin - context->input.begin);
+  r->region.begin.line   = 0;
+  r->region.begin.column = 0;
+  r->region.end.data     = end;
+  r->region.end.offset   = (unsigned int)(end - context->input.begin);
+  r->region.end.line     = 0;
+  r->region.end.column   = 0;
+  r->userData = 0;
   r->count = count;
-  r->childs = count == 0 ? 0 : calloc(count, sizeof(struct Result));
+  r->kind = 0;
   return r;
 }
+/** Увеличивает счетчик ссылок на результат. Константы FAILED и NIL, а также узлы, выделенные
+    в арене, не изменяются.
+*/
+struct Result* retainResult(struct Result* result) {
+  assert(result);
+  if (result != &FAILED && result != &NIL && result->refs > 0) {
+    ++result->refs;
+  }
+  return result;
+}
+/** Запоминает в результате номер правила @a kind (увеличенный на 1), если в нем еще нет номера
+    более вложенного правила.
+*/
+void setKind(struct Result* result, unsigned int kind) {
+  assert(result);
+  if (result != &FAILED && result != &NIL && result->kind == 0) {
+    result->kind = kind;
+  }
+}
+/** Создает пустой результат для повторения элементов, начинающийся в текущей позиции. Элементы
+    добавляются в него функцией append.
+*/
+struct Result* createArray(struct Context* context) {
+  const char* begin = context->input.begin + context->current;
+  return allocResult(context, begin, begin, 0);
+}
+/** Добавляет очередной элемент повторения в конец массива @a array. Емкость массива потомков
+    не хранится: она равна ближайшей сверху степени двойки от количества элементов, но не менее 4.
+*/
+void append(struct Context* context, struct Result* array, struct Result* item) {
+  unsigned int count;
+  assert(array);
+  assert(item);
+
+  count = array->count;
+  if (count == 0 || (count >= 4 && (count & (count - 1)) == 0)) {
+    unsigned int capacity = count == 0 ? 4 : count * 2;
+    if (context->arena) {
+      struct Result** childs = (struct Result**)allocArena(context->arena, capacity * sizeof(struct Result*));
+      if (count > 0) {
+        memcpy(childs, array->childs, count * sizeof(struct Result*));
+      }
+      array->childs = childs;
+    } else {
+      array->childs = (struct Result**)realloc(array->childs, capacity * sizeof(struct Result*));
+      assert(array->childs);
+    }
+  }
+  array->childs[count] = item;
+  array->count = count + 1;
+  array->region.end.data   = item->region.end.data;
+  array->region.end.offset = item->region.end.offset;
+}
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 /* Работа с ожидаемыми элементами. */
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-void clearExpected(struct FailInfo* info) {
-  assert(info);
-  free(info->expected);
-  info->count = 0;
-  info->expected = 0;
+/** Количество бит в одном слове множества ожидаемых элементов. */
+#define EXPECTED_WORD_BITS (sizeof(unsigned long) * CHAR_BIT)
+/** Количество слов, достаточное для множества из @a count ожидаемых элементов. */
+#define EXPECTED_WORDS(count) (((count) + EXPECTED_WORD_BITS - 1) / EXPECTED_WORD_BITS)
+
+#define MAKE_TYPEANDLEN(type, len) ((type << (sizeof(((struct Expected*)0)->typeAndLen)*8 - 3)) | len)
+/** Ожидаемый элемент для любого символа. Всегда имеет номер 0, элементы, создаваемые генератором,
+    нумеруются с 1.
+*/
+static const struct Expected ANY_EXPECTED = {
+  MAKE_TYPEANDLEN(E_EX_TYPE_ANY, sizeof("any character") / sizeof(char)),
+  "any character",
+  0
+};
+#undef MAKE_TYPEANDLEN
+
+/** Подготавливает множество ожидаемых элементов контекста к разбору.
+
+@param table Все ожидаемые элементы парсера в порядке их номеров.
+@param count Количество элементов в @a table.
+@param bits Память под множество, не меньше EXPECTED_WORDS(count) слов.
+*/
+void initExpected(struct Context* context, const struct Expected* const* table, unsigned int count, unsigned long* bits) {
+  assert(context);
+  assert(table);
+  assert(bits);
+  context->expected.table = table;
+  context->expected.count = count;
+  context->expected.bits  = bits;
+  memset(bits, 0, EXPECTED_WORDS(count) * sizeof(unsigned long));
 }
-void pushExpected(struct FailInfo* info, struct Expected* expected) {
-  unsigned int count;
+/** Очищает множество ожидаемых элементов. Память при этом не выделяется и не освобождается. */
+void clearExpected(struct Context* context) {
+  assert(context);
+  memset(context->expected.bits, 0, EXPECTED_WORDS(context->expected.count) * sizeof(unsigned long));
+}
+void pushExpected(struct FailInfo* info, const struct Expected* expected) {
   assert(info);
   assert(expected);
 
-  count = ++info->count;
-  info->expected = (const struct Expected**)realloc(info->expected, count * sizeof(*info->expected));
-  info->expected[count-1] = expected;
+  if (info->count == info->capacity) {
+    info->capacity = info->capacity == 0 ? 8 : info->capacity * 2;
+    info->expected = (const struct Expected**)realloc(info->expected, info->capacity * sizeof(*info->expected));
+    assert(info->expected);
+  }
+  info->expected[info->count++] = expected;
+}
+/** Строит в `failInfo.expected` список ожидаемых элементов из множества контекста. Вызывается
+    только тогда, когда информация об ошибке действительно нужна, а память списка переиспользуется
+    при повторных вызовах.
+*/
+void collectExpected(struct Context* context) {
+  const struct ExpectedSet* set = &context->expected;
+  unsigned int w;
+  unsigned int i;
+  assert(context);
+
+  context->failInfo.count = 0;
+  for (w = 0; w < EXPECTED_WORDS(set->count); ++w) {
+    if (set->bits[w] == 0) {
+      continue;
+    }
+    for (i = 0; i < EXPECTED_WORD_BITS; ++i) {
+      if (set->bits[w] & (1ul << i)) {
+        pushExpected(&context->failInfo, set->table[w * EXPECTED_WORD_BITS + i]);
+      }
+    }
+  }
 }
-struct Result* fail(struct Context* context, struct Expected* expected) {
+struct Result* fail(struct Context* context, const struct Expected* expected) {
   assert(context);
   assert(expected);
   /*  Если подавление запоминания позиций ошибки разбора не включено, то пытаемся
       запомнить позицию, если она расположена во входных данных позже, чем уже имеющиеся.
   */
   if (context->failInfo.silent == 0) {
-    if (context->current.offset < context->failInfo.pos.offset) { return &FAILED; }
+    PEG_FAILED(context);
+    if (context->current < context->failInfo.pos.offset) { return &FAILED; }
 
-    if (context->current.offset > context->failInfo.pos.offset) {
-      memcpy(&context->failInfo.pos, &context->current, sizeof(struct Location));
-      clearExpected(&context->failInfo);
+    if (context->current > context->failInfo.pos.offset) {
+      context->failInfo.pos.data   = context->input.begin + context->current;
+      context->failInfo.pos.offset = context->current;
+      clearExpected(context);
     }
 
-    pushExpected(&context->failInfo, expected);
+    assert(expected->id < context->expected.count);
+    context->expected.bits[expected->id / EXPECTED_WORD_BITS] |= 1ul << (expected->id % EXPECTED_WORD_BITS);
   }
   return &FAILED;
 }
@@ -164,104 +505,1692 @@ struct Result* fail(struct Context* context, struct Expected* expected) {
 /* Работа с позицией. */
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 void movePos(struct Context* context, unsigned int count) {
-  context->current.data += count;
-  context->current.offset += count;
-  
-  /*TODO: Скорректировать line и column*/
+  context->current += count;
+  /* Номера строки и столбца не отслеживаются, их по смещению вычисляет resolveLocation. */
 }
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-/* Правила разбора примитивов. */
+/* Номера строк и столбцов. */
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-/** Если в разбираемых данных еще не достигнут конец, продвигает текущую позицию на один символ
-    вперед и возвращает результат с границами от текущей позиции до текущей позиции плюс 1.
-    В случае неудачи позиция остается неизменной и возвращается константа FAILED.
+/** Находит первый байт '\r' или '\n', начиная с @a p, но не далее @a end. Байты проверяются
+    блоками по 32 или 16 штук с помощью AVX2 или SSE2, блок с переводом строки -- побайтно.
 
-@param context Информация о разбираемом участке и текущей в нем позиции.
+@return Указатель на найденный байт или @a end, если его нет.
+*/
+static const char* findNewline(const char* p, const char* end) {
+#ifdef PEG_AVX2
+  while (end - p >= 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)p);
+    __m256i m = _mm256_or_si256(
+      _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r')),
+      _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'))
+    );
+    if (_mm256_movemask_epi8(m) != 0) {
+      break;
+    }
+    p += 32;
+  }
+#endif
+#ifdef PEG_SSE2
+  while (end - p >= 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)p);
+    __m128i m = _mm_or_si128(
+      _mm_cmpeq_epi8(x, _mm_set1_epi8('\r')),
+      _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'))
+    );
+    if (_mm_movemask_epi8(m) != 0) {
+      break;
+    }
+    p += 16;
+  }
+#endif
+  while (p < end && *p != '\r' && *p != '\n') {
+    ++p;
+  }
+  return p;
+}
+/** Создает пустой индекс начал строк данных от @a begin до @a end. Данные не просматриваются, пока
+    не потребуется вычислить номер строки. Индекс необходимо освободить функцией freeLineIndex.
+*/
+void initLineIndex(struct LineIndex* index, const char* begin, const char* end) {
+  assert(index);
+  assert(begin <= end);
+  index->begin = begin;
+  index->end = end;
+  index->scanned = begin;
+  index->count = 1;
+  index->capacity = 64;
+  index->starts = (unsigned int*)malloc(index->capacity * sizeof(unsigned int));
+  assert(index->starts);
+  /* Первая строка начинается с начала данных. */
+  index->starts[0] = 0;
+}
+void freeLineIndex(struct LineIndex* index) {
+  assert(index);
+  free(index->starts);
+  index->starts = 0;
+  index->count = 0;
+  index->capacity = 0;
+}
+/** Просматривает данные, пока граница просмотра не окажется за @a limit, добавляя в индекс
+    найденные начала строк.
+*/
+static void scanLines(struct LineIndex* index, const char* limit) {
+  while (index->scanned <= limit && index->scanned < index->end) {
+    const char* p = findNewline(index->scanned, index->end);
+    if (p == index->end) {
+      index->scanned = p;
+      break;
+    }
+    /* Пара '\r\n' -- один перевод строки. */
+    if (*p == '\r' && p + 1 < index->end && p[1] == '\n') {
+      ++p;
+    }
+    if (index->count == index->capacity) {
+      index->capacity *= 2;
+      index->starts = (unsigned int*)realloc(index->starts, index->capacity * sizeof(unsigned int));
+      assert(index->starts);
+    }
+    index->starts[index->count++] = (unsigned int)(p + 1 - index->begin);
+    index->scanned = p + 1;
+  }
+}
+/** Вычисляет смещение, номер строки и номер столбца позиции по указателю на ее данные
+    (поле `data`). Начала строк ищутся двоичным поиском, а данные просматриваются только до
+    этой позиции, если не были просмотрены ранее.
 
-@return Результат разбора или константу FAILED, если разбор неудачен. Результат необходимо
-        освободить функцией freeResult, когда он больше не будет нужен.
+@param index Индекс начал строк данных, которым принадлежит позиция.
+@param location Позиция, поля `offset`, `line` и `column` которой будут заполнены.
 */
-struct Result* parseAny(struct Context* context) {
-#define MAKE_TYPEANDLEN(type, len) ((type << (sizeof(((struct Expected*)0)->typeAndLen)*8 - 3)) | len)
-  static struct Expected expected = {
-    MAKE_TYPEANDLEN(E_EX_TYPE_ANY, sizeof("any character") / sizeof(char)),
-    "any character"
-  };
-#undef MAKE_TYPEANDLEN
-  const char* begin = context->input.begin + context->current.offset;
+void resolveLocation(struct LineIndex* index, struct Location* location) {
+  unsigned int offset;
+  unsigned int lo;
+  unsigned int hi;
+  assert(index);
+  assert(location);
+  assert(location->data >= index->begin && location->data <= index->end);
 
-  if (begin < context->input.end) {
-    movePos(context, 1);
-    return allocResult(begin, begin + 1, 0);
+  offset = (unsigned int)(location->data - index->begin);
+  scanLines(index, location->data);
+  /* Ищем последнее начало строки, не превосходящее смещения. starts[0] == 0 всегда подходит. */
+  lo = 0;
+  hi = index->count;
+  while (hi - lo > 1) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (index->starts[mid] <= offset) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  location->offset = offset;
+  location->line   = lo + 1;
+  location->column = offset - index->starts[lo] + 1;
+}
+/** Вычисляет смещения, номера строк и столбцов обеих границ региона, например, региона
+    @link Result результата разбора@endlink.
+*/
+void resolveRegion(struct LineIndex* index, struct Region* region) {
+  assert(region);
+  resolveLocation(index, &region->begin);
+  resolveLocation(index, &region->end);
+}
+#ifdef PEG_PROFILE
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/* Профилирование. */
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/** Кадр профилирования разбираемого правила. Кадры лежат в стеке функций разбора и связаны
+    в список от самого вложенного правила к стартовому.
+*/
+struct ProfileFrame {
+  /** Номер правила. */
+  unsigned int rule;
+  /** Позиция, с которой начат разбор правила. */
+  unsigned int start;
+  /** Показание счетчика времени в начале разбора правила. */
+  unsigned long clock;
+  /** Время, проведенное во вложенных правилах. */
+  unsigned long children;
+  /** Кадр правила, из которого вызвано данное, или `NULL` для стартового правила. */
+  struct ProfileFrame* parent;
+};
+/** Начинает профилирование правила @a rule. Вызывается макросом PEG_PROFILE_ENTER. */
+static void enterRule(struct Context* context, struct ProfileFrame* frame, unsigned int rule) {
+  frame->rule     = rule;
+  frame->start    = context->current;
+  frame->children = 0;
+  frame->parent   = context->frame;
+  context->frame  = frame;
+  if (context->profile) {
+    ++context->profile->rules[rule].calls;
+  }
+  frame->clock = PEG_PROFILE_CLOCK();
+}
+/** Заканчивает профилирование правила результатом @a result. Вызывается макросом PEG_PROFILE_LEAVE. */
+static void leaveRule(struct Context* context, struct ProfileFrame* frame, const struct Result* result) {
+  unsigned long elapsed = PEG_PROFILE_CLOCK() - frame->clock;
+  struct RuleProfile* p;
+
+  context->frame = frame->parent;
+  if (frame->parent) {
+    frame->parent->children += elapsed;
+  }
+  if (context->profile == 0) {
+    return;
+  }
+  p = &context->profile->rules[frame->rule];
+  if (isFailed(result)) {
+    ++p->failures;
   } else {
-    return fail(context, &expected);
+    ++p->successes;
+    p->consumed += context->current - frame->start;
   }
+  p->ticks += elapsed - frame->children;
 }
-/** Если указанная строка @a literal является подстрокой разбираемых данных, начиная с текущей
-    позиции разбора, то продвигает текущую позицию на величину @a len и возвращает результат с
-    границами от текущей позиции до текущей позиции плюс @a len.
-    В случае неудачи позиция остается неизменной и возвращается константа FAILED.
+/** Учитывает обращение к таблице мемоизации правилом, разбираемым в данный момент. Вызывается
+    макросом PEG_PROFILE_MEMO, который есть только в правилах с мемоизацией, поэтому, как и функции
+    мемоизации, объявлена не статической: в парсере без мемоизации она остается неиспользованной.
+*/
+void profileMemo(struct Context* context, int hit) {
+  if (context->profile && context->frame) {
+    if (hit) {
+      ++context->profile->rules[context->frame->rule].memoHits;
+    } else {
+      ++context->profile->rules[context->frame->rule].memoMisses;
+    }
+  }
+}
+/** Учитывает откат текущей позиции к позиции @a pos в правиле, разбираемом в данный момент. */
+static void profileBacktrack(struct Context* context, unsigned int pos) {
+  if (context->profile && context->frame && context->current > pos) {
+    context->profile->rules[context->frame->rule].backtracked += context->current - pos;
+  }
+}
+#ifdef PEG_THREADS
+#include <pthread.h>
+/** Защищает общие таблицы профилирования от одновременного переноса счетчиков из разных потоков. */
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+/** Обнуляет все счетчики таблицы профилирования. */
+void resetProfile(struct Profile* profile) {
+  assert(profile);
+  memset(profile->rules, 0, profile->count * sizeof(struct RuleProfile));
+}
+/** Подготавливает таблицу профилирования одного разбора со счетчиками в массиве @a rules, которые
+    будут перенесены в таблицу @a total. Используется генерируемыми функциями разбора.
+*/
+void initProfile(struct Profile* profile, struct RuleProfile* rules, struct Profile* total) {
+  assert(profile);
+  assert(total);
+  profile->count = total->count;
+  profile->names = total->names;
+  profile->rules = rules;
+  profile->total = total;
+  resetProfile(profile);
+}
+/** Переносит счетчики таблицы в таблицу, указанную в ее поле total, и обнуляет их. При
+    параллельном разборе перенос выполняется под блокировкой, поэтому потоки пишут каждый в свою
+    таблицу без синхронизации, а синхронизируются только по окончании разбора.
+*/
+void flushProfile(struct Profile* profile) {
+  unsigned int i;
+  assert(profile);
+  if (profile->total == 0) {
+    return;
+  }
+#ifdef PEG_THREADS
+  pthread_mutex_lock(&profileLock);
+#endif
+  for (i = 0; i < profile->count; ++i) {
+    const struct RuleProfile* from = &profile->rules[i];
+    struct RuleProfile* to = &profile->total->rules[i];
+    to->calls       += from->calls;
+    to->successes   += from->successes;
+    to->failures    += from->failures;
+    to->consumed    += from->consumed;
+    to->backtracked += from->backtracked;
+    to->memoHits    += from->memoHits;
+    to->memoMisses  += from->memoMisses;
+    to->ticks       += from->ticks;
+  }
+#ifdef PEG_THREADS
+  pthread_mutex_unlock(&profileLock);
+#endif
+  resetProfile(profile);
+}
+/** Создает таблицу профилирования сессии, счетчики которой переносятся в таблицу @a total.
+
+@return Новую таблицу или `NULL`, если не хватило памяти.
+*/
+struct Profile* newProfile(struct Profile* total) {
+  struct Profile* p;
+  assert(total);
+  p = (struct Profile*)malloc(sizeof(struct Profile));
+  if (p == 0) {
+    return 0;
+  }
+  /* Массив из одного элемента, если в грамматике нет правил: calloc(0) может вернуть NULL. */
+  p->rules = (struct RuleProfile*)calloc(total->count > 0 ? total->count : 1, sizeof(struct RuleProfile));
+  if (p->rules == 0) {
+    free(p);
+    return 0;
+  }
+  initProfile(p, p->rules, total);
+  return p;
+}
+/** Переносит счетчики таблицы, созданной newProfile, в общую таблицу и уничтожает ее. */
+void freeProfile(struct Profile* profile) {
+  if (profile) {
+    flushProfile(profile);
+    free(profile->rules);
+    free(profile);
+  }
+}
+static int compareRuleProfiles(const void* a, const void* b) {
+  const struct RuleProfile* l = *(const struct RuleProfile* const*)a;
+  const struct RuleProfile* r = *(const struct RuleProfile* const*)b;
+  if (l->ticks       != r->ticks)       { return l->ticks       > r->ticks       ? -1 : 1; }
+  if (l->backtracked != r->backtracked) { return l->backtracked > r->backtracked ? -1 : 1; }
+  if (l->calls       != r->calls)       { return l->calls       > r->calls       ? -1 : 1; }
+  return l < r ? -1 : l > r ? 1 : 0;
+}
+/** Печатает отчет о профилировании вызывавшихся правил, упорядоченных по убыванию стоимости:
+    времени, проведенного в самом правиле, затем количества байт отката и количества вызовов.
+
+@return 0 в случае успеха или -1, если не хватило памяти.
+*/
+int printProfile(const struct Profile* profile, FILE* out) {
+  const struct RuleProfile** order;
+  unsigned int i, count = 0;
+  int width = 4;
+
+  assert(profile);
+  order = (const struct RuleProfile**)malloc((profile->count + 1) * sizeof(struct RuleProfile*));
+  if (order == 0) {
+    return -1;
+  }
+  for (i = 0; i < profile->count; ++i) {
+    if (profile->rules[i].calls > 0) {
+      int len = (int)strlen(profile->names[i]);
+      order[count++] = &profile->rules[i];
+      width = len > width ? len : width;
+    }
+  }
+  qsort(order, count, sizeof(order[0]), compareRuleProfiles);
+
+  fprintf(out, "%-*s %12s %12s %12s %12s %12s %12s %12s %14s\n", width, "rule",
+    "calls", "successes", "failures", "consumed", "backtracked", "memo hits", "memo misses", "ticks");
+  for (i = 0; i < count; ++i) {
+    const struct RuleProfile* p = order[i];
+    fprintf(out, "%-*s %12lu %12lu %12lu %12lu %12lu %12lu %12lu %14lu\n", width,
+      profile->names[p - profile->rules], p->calls, p->successes, p->failures,
+      p->consumed, p->backtracked, p->memoHits, p->memoMisses, p->ticks);
+  }
+  free((void*)order);
+  return 0;
+}
+#endif
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/* Мемоизация. */
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/** Создает таблицу мемоизации, занимающую не более @a limit байт. Если памяти не хватает даже на
+    одну запись или ее не удалось выделить, мемоизация отключается -- разбор остается корректным,
+    но перестает быть линейным.
+
+@param context Контекст, в котором создается таблица.
+@param limit Максимальный размер таблицы в байтах.
+*/
+void initMemo(struct Context* context, unsigned long limit) {
+  unsigned long size;
+  assert(context);
+
+  limit /= sizeof(struct MemoEntry);
+  size = 1;
+  while (size * 2 <= limit && size * 2 <= (~0u >> 1)) {
+    size *= 2;
+  }
+  context->memo.entries = size <= limit
+    ? (struct MemoEntry*)calloc(size, sizeof(struct MemoEntry))
+    : 0;
+  context->memo.size = context->memo.entries ? (unsigned int)size : 0;
+}
+/** Освобождает таблицу мемоизации и ссылки на все запомненные в ней результаты. Узлы арены таблица
+    не удерживает: они могут быть уже освобождены вместе с ней (см. resetArena).
+*/
+void freeMemo(struct Context* context) {
+  unsigned int i;
+  assert(context);
+  for (i = 0; i < context->memo.size && context->arena == 0; ++i) {
+    if (context->memo.entries[i].rule != 0) {
+      freeResult(context->memo.entries[i].result);
+    }
+  }
+  free(context->memo.entries);
+  context->memo.size = 0;
+  context->memo.entries = 0;
+}
+/** Делает все запомненные результаты недействительными, не обходя таблицу. Ссылки на результаты
+    освобождаются по мере вытеснения записей или в freeMemo.
+*/
+void forgetMemo(struct Context* context) {
+  assert(context);
+  context->memo.count = 0;
+  if (++context->memo.epoch == 0) {
+    /* Номер поколения переполнился: старые записи могут его повторить, поэтому чистим таблицу. */
+    unsigned int i;
+    for (i = 0; i < context->memo.size; ++i) {
+      if (context->memo.entries[i].rule != 0) {
+        if (context->arena == 0) {
+          freeResult(context->memo.entries[i].result);
+        }
+        context->memo.entries[i].rule = 0;
+      }
+    }
+  }
+}
+static struct MemoEntry* findMemoSlot(struct Context* context, unsigned int rule, unsigned int offset) {
+  /* Умножение на нечетную константу переставляет младшие биты смещения, поэтому подряд идущие
+  позиции одного правила всегда попадают в разные ячейки. */
+  return &context->memo.entries[(offset * 0x9E3779B1u + rule) & (context->memo.size - 1)];
+}
+/** Ищет в таблице мемоизации результат разбора правила @a rule с текущей позиции. Если он найден,
+    текущая позиция перемещается в конец запомненного результата.
 
 @param context Информация о разбираемом участке и текущей в нем позиции.
-@param literal Литерал, с которым осуществляется сопоставление разбираемых данных.
+@param rule Номер правила в грамматике.
+@param result Переменная, в которую будет помещен найденный результат. Результат необходимо
+       освободить функцией freeResult, когда он больше не будет нужен.
 
-@return Результат разбора или константу FAILED, если разбор неудачен. Результат необходимо
-        освободить функцией freeResult, когда он больше не будет нужен.
+@return 1, если результат найден, иначе 0.
 */
-struct Result* parseLiteral(struct Context* context, struct Literal* literal, struct Expected* expected) {
+int recallMemo(struct Context* context, unsigned int rule, struct Result** result) {
+  struct MemoEntry* e;
   assert(context);
-  assert(literal);
-  assert(expected);
-  if (matchLiteral(context, literal)) {
-    const char* begin = context->input.begin + context->current.offset;
-    movePos(context, literal->len);
-    return allocResult(begin, begin + literal->len, 0);
-  } else {
-    return fail(context, expected);
+  assert(result);
+  if (context->memo.size == 0) {
+    return 0;
+  }
+  e = findMemoSlot(context, rule, context->current);
+  if (e->rule != rule + 1 || e->offset != context->current || e->epoch != context->memo.epoch) {
+    return 0;
+  }
+  context->current = e->end;
+  if (context->examined < e->examined) {
+    context->examined = e->examined;
   }
+  /* Неудачи, сообщенные при разборе правила, сдвигают позицию ошибки так же, как при его разборе. */
+  if (context->failInfo.silent == 0 && context->failed < e->failed) {
+    context->failed = e->failed;
+    if (context->failInfo.pos.offset < e->failed) {
+      context->failInfo.pos.data   = context->input.begin + e->failed;
+      context->failInfo.pos.offset = e->failed;
+      clearExpected(context);
+    }
+  }
+  *result = retainResult(e->result);
+  return 1;
 }
-struct Result* parseCharClass(struct Context* context, struct CharClass* cls, struct Expected* expected, int inverted) {
+/** Запоминает результат разбора правила @a rule, начатого с позиции @a start и закончившегося в
+    текущей позиции. Если ячейка таблицы уже занята, ее прежнее содержимое вытесняется.
+
+@param context Информация о разбираемом участке и текущей в нем позиции.
+@param rule Номер правила в грамматике.
+@param start Смещение, с которого начинался разбор правила.
+@param result Результат разбора правила. Таблица захватывает на него собственную ссылку.
+*/
+void rememberMemo(struct Context* context, unsigned int rule, unsigned int start, struct Result* result) {
+  struct MemoEntry* e;
   assert(context);
-  assert(cls);
-  assert(expected);
-  if (matchCharClass(context, cls, inverted)) {
-    const char* begin = context->input.begin + context->current.offset;
-    movePos(context, 1);
-    return allocResult(begin, begin + 1, 0);
-  } else {
-    return fail(context, expected);
+  assert(result);
+  if (context->memo.size == 0) {
+    return;
+  }
+  e = findMemoSlot(context, rule, start);
+#ifdef PEG_INCREMENTAL
+  /* Из двух записей, претендующих на одну ячейку, остается прочитавшая больше данных: ее дороже
+     разбирать заново после правки. */
+  if (context->examined - start < PEG_MEMO_SPAN || (e->rule != 0 && e->epoch == context->memo.epoch
+      && e->examined - e->offset > context->examined - start)) {
+    return;
+  }
+#endif
+  if (e->rule != 0 && context->arena == 0) {
+    freeResult(e->result);
   }
+  e->rule = rule + 1;
+  e->offset = start;
+  e->epoch = context->memo.epoch;
+  ++context->memo.count;
+  e->result = retainResult(result);
+  /* Запомненный результат в арене не должен потеряться при откате. */
+  if (context->arena && result != &FAILED && result != &NIL) {
+    context->arena->pin = context->arena->used;
+  }
+  e->end = context->current;
+  e->examined = context->examined;
+  e->failed = context->failed;
 }
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-struct Result* wrap(struct Context* context, unsigned int pos, unsigned int count, ...) {
-  struct Result* r;
-  unsigned int i;
+/* Потоковый разбор. */
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/** Фиксирует разбор всех данных до текущей позиции: удаляет их из буфера окна, сдвигая остаток в
+    начало, и забывает запомненные результаты и ошибки, относящиеся к удаленным данным. Вызывается
+    только тогда, когда не осталось ни одного результата, ссылающегося на данные окна.
+*/
+void commitStream(struct Context* context) {
+  struct Stream* s = context->stream;
+  unsigned int consumed = context->current;
+  assert(s);
 
-  va_list results;
-  va_start(results, count);
+  memmove(s->buffer, s->buffer + consumed, (context->input.end - context->input.begin) - consumed);
+  context->input.end -= consumed;
+  context->current = 0;
+  s->base += consumed;
+  clearExpected(context);
+  memset(&context->failInfo.pos, 0, sizeof(struct Location));
+  context->failInfo.pos.data = context->input.begin;
+  forgetMemo(context);
+}
+/** Разбирает поток как последовательность записей, каждая из которых разбирается правилом @a func.
+    После разбора очередной записи она передается в @a onRecord, освобождается, и разбор
+    фиксируется функцией commitStream, поэтому память не растет вместе с длиной потока.
 
-  r = allocResult(context->input.begin + pos, context->input.begin + context->current.offset, count);
-  for (i = 0; i < count; ++i) {
-    assert(r->childs);
-    r->childs[i] = va_arg(results, struct Result*);
-    assert(r->childs[i]);
+@return Одно из значений перечисления E_STREAM_STATUS.
+*/
+int parseRecords(struct Context* context, RuleFunc func, RecordFunc onRecord, void* data) {
+  struct Stream* s = context->stream;
+  assert(s);
+  assert(func);
+
+  while (available(context, 1)) {
+    struct Result* r = (*func)(context);
+    int stop;
+    /* Запись, не поглотившая ни одного байта, повторялась бы бесконечно. */
+    if (isFailed(r) || context->current == 0) {
+      freeResult(r);
+      return s->overflow ? E_STREAM_OVERFLOW : E_STREAM_FAILED;
+    }
+    /* Запись была разобрана так, как будто данные закончились на границе буфера. */
+    if (s->overflow) {
+      freeResult(r);
+      return E_STREAM_OVERFLOW;
+    }
+    stop = onRecord && (*onRecord)(data, r, s->base);
+    freeResult(r);
+    if (stop) {
+      return E_STREAM_STOPPED;
+    }
+    commitStream(context);
   }
+  return s->overflow ? E_STREAM_OVERFLOW : E_STREAM_OK;
+}
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/* Сессии разбора. */
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+struct Session {
+  /** Контекст разбора, переиспользуемый всеми разборами сессии. */
+  struct Context context;
+  /** Функция стартового правила. */
+  RuleFunc func;
+};
+/** Создает сессию разбора правилом @a func. Используется генерируемой функцией createSession.
 
-  va_end(results);
-  return r;
+@param memoLimit Размер таблицы мемоизации в байтах или 0, если мемоизация не нужна.
+@param table Все ожидаемые элементы парсера в порядке их номеров.
+@param count Количество элементов в @a table.
+
+@return Новую сессию или `NULL`, если не хватило памяти.
+*/
+struct Session* newSession(RuleFunc func, void* data, unsigned long memoLimit, const struct Expected* const* table, unsigned int count) {
+  struct Session* s = (struct Session*)calloc(1, sizeof(struct Session));
+  unsigned long* bits;
+  if (s == 0) {
+    return 0;
+  }
+  bits = (unsigned long*)calloc(EXPECTED_WORDS(count), sizeof(unsigned long));
+  s->func = func;
+  s->context.userData = data;
+  s->context.arena = createArena();
+  if (s->context.arena == 0 || bits == 0) {
+    destroyArena(s->context.arena);
+    free(bits);
+    free(s);
+    return 0;
+  }
+  initExpected(&s->context, table, count, bits);
+  if (memoLimit > 0) {
+    initMemo(&s->context, memoLimit);
+  }
+  return s;
 }
-static int findRuleCompatator(const struct Range* name, const struct ParseFunc* entry) {
-  unsigned int len;
-  assert(name);
-  assert(name->begin);
-  assert(name->end);
-  assert(entry);
-  len = name->end - name->begin;
-  if (len < entry->len) { return -1; }
-  if (len > entry->len) { return +1; }
-  return memcmp(name->begin, entry->name, len);
+/** Разбирает @a len байт данных @a input стартовым правилом сессии. Память предыдущего разбора
+    не освобождается, а используется повторно, поэтому подготовка к разбору почти ничего не стоит.
+
+@return Результат разбора, константу FAILED, если разбор неудачен, или `NULL`, если у сессии нет
+        стартового правила. Результат принадлежит сессии и действителен до следующего вызова
+        parseSession или destroySession; освобождать его не нужно.
+*/
+struct Result* parseSession(struct Session* session, const char* input, unsigned int len) {
+  struct Context* ctx;
+  assert(session);
+  assert(input);
+  if (session->func == 0) {
+    return 0;
+  }
+  ctx = &session->context;
+  resetArena(ctx->arena);
+  forgetMemo(ctx);
+  ctx->input.begin = input;
+  ctx->input.end   = input + len;
+  ctx->current = 0;
+  ctx->failInfo.silent = 0;
+  ctx->failInfo.pos.data = input;
+  ctx->failInfo.pos.offset = 0;
+  clearExpected(ctx);
+  return (*session->func)(ctx);
 }
-const struct ParseFunc* findRule(const struct ParseFunc* table, size_t count, const struct Range* name) {
+/** Возвращает информацию об ошибке последнего разбора сессии, строя по запросу список
+    ожидаемых элементов. Она действительна до следующего вызова parseSession или destroySession.
+*/
+const struct FailInfo* sessionFailInfo(struct Session* session) {
+  assert(session);
+  collectExpected(&session->context);
+  return &session->context.failInfo;
+}
+#ifdef PEG_PROFILE
+/** Возвращает таблицу счетчиков профилирования разборов сессии, еще не перенесенных в таблицу
+    парсера. Счетчики переносятся при уничтожении сессии.
+*/
+struct Profile* sessionProfile(struct Session* session) {
+  assert(session);
+  return session->context.profile;
+}
+#endif
+/** Уничтожает сессию вместе со всеми результатами ее разборов. Счетчики профилирования сессии
+    при этом переносятся в таблицу парсера.
+*/
+void destroySession(struct Session* session) {
+  if (session) {
+#ifdef PEG_PROFILE
+    freeProfile(session->context.profile);
+#endif
+    freeMemo(&session->context);
+    free(session->context.failInfo.expected);
+    free(session->context.expected.bits);
+    destroyArena(session->context.arena);
+    free(session);
+  }
+}
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/* Инкрементальный разбор. */
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/** Во сколько раз память арены может превысить память, занятую после полного разбора, прежде чем
+    очередная правка приведет к полному разбору. Результаты, замененные после правок, остаются в
+    арене до полного разбора.
+*/
+#define DOCUMENT_GARBAGE 4
+/** На сколько частей по смещению делятся сдвигаемые при правке записи таблицы мемоизации, чтобы
+    обходить их результаты в порядке расположения в данных.
+*/
+#define DOCUMENT_BUCKETS 4096
+
+/** Массив указателей на узлы результатов, память которого переиспользуется от правки к правке. */
+struct ResultList {
+  struct Result** items;
+  /** Количество узлов в массиве. */
+  unsigned int count;
+  /** Размер массива items. */
+  unsigned int capacity;
+};
+/** Увеличивает массив так, чтобы в нем поместилось @a count узлов.
+
+@return 1 в случае успеха или 0, если не хватило памяти.
+*/
+static int reserveResults(struct ResultList* list, unsigned int count) {
+  struct Result** items;
+  unsigned int capacity = list->capacity > 0 ? list->capacity : 1024;
+  if (count <= list->capacity) {
+    return 1;
+  }
+  while (capacity < count) {
+    capacity *= 2;
+  }
+  items = (struct Result**)realloc((void*)list->items, capacity * sizeof(struct Result*));
+  if (items == 0) {
+    return 0;
+  }
+  list->items = items;
+  list->capacity = capacity;
+  return 1;
+}
+
+struct Document {
+  /** Сессия, в таблице мемоизации и арене которой хранятся результаты разбора. */
+  struct Session* session;
+  /** Данные документа. */
+  char* buffer;
+  /** Размер данных. */
+  unsigned int length;
+  /** Размер буфера. */
+  unsigned int capacity;
+  /** Результат последнего разбора. */
+  struct Result* result;
+  /** Память арены, занятая после последнего полного разбора. */
+  unsigned long baseline;
+  /** Буфер для записей таблицы мемоизации, переносимых при правке в другие ячейки. */
+  struct MemoEntry* moved;
+  /** Размер буфера moved в записях. */
+  unsigned int movedCapacity;
+  /** Результаты записей из буфера moved в порядке их смещений. */
+  struct ResultList order;
+  /** Узлы, сдвинутые при правке. */
+  struct ResultList shifted;
+};
+/** Сдвигает на разницу длин вставленных и удаленных данных смещения всех узлов результата,
+    лежащих после правки, и добавляет их в массив @a shifted. Узлы могут входить в результаты
+    нескольких записей таблицы мемоизации, но сдвигать их нужно ровно один раз: указатели на
+    данные пока не меняются, поэтому у уже сдвинутого узла смещение начала не соответствует
+    указателю, и его поддерево пропускается.
+
+@return 1 в случае успеха или 0, если не хватило памяти.
+*/
+static int shiftResult(struct ResultList* shifted, struct Result* result, unsigned int removed, unsigned int inserted, const char* buffer) {
+  unsigned int i;
+  if (result == &FAILED || result == &NIL || result->region.begin.data != buffer + result->region.begin.offset) {
+    return 1;
+  }
+  if (!reserveResults(shifted, shifted->count + 1)) {
+    return 0;
+  }
+  shifted->items[shifted->count++] = result;
+  result->region.begin.offset = result->region.begin.offset - removed + inserted;
+  result->region.end.offset   = result->region.end.offset   - removed + inserted;
+  for (i = 0; i < result->count; ++i) {
+    if (!shiftResult(shifted, result->childs[i], removed, inserted, buffer)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+/** Приводит таблицу мемоизации документа в соответствие с данными после замены @a removed байт,
+    начиная со смещения @a start, на @a inserted байт. Записи, прочитавшие измененные данные,
+    удаляются, а записи после правки вместе с их результатами сдвигаются. Таблица обновляется на
+    месте: сдвинутые записи переносятся в новые ячейки через буфер документа.
+
+@return 1 в случае успеха или 0, если не хватило памяти. Тогда таблица и результаты в ней могут
+        быть изменены лишь частично, и ее нельзя использовать без forgetMemo.
+*/
+static int shiftMemo(struct Document* document, unsigned int start, unsigned int removed, unsigned int inserted) {
+  struct Context* context = &document->session->context;
+  struct Memo* memo = &context->memo;
+  const char* buffer = context->input.begin;
+  unsigned int end = start + removed;
+  unsigned int length = document->length;
+  unsigned int counts[DOCUMENT_BUCKETS + 1];
+  unsigned int moved = 0;
+  unsigned int i;
+
+  memset(counts, 0, sizeof(counts));
+  document->shifted.count = 0;
+  for (i = 0; i < memo->size; ++i) {
+    struct MemoEntry* e = &memo->entries[i];
+    if (e->rule == 0 || e->epoch != memo->epoch) {
+      continue;
+    }
+    /* Запись прочитала удаленные данные или место вставки. */
+    if (e->examined > start && (e->offset < end || (removed == 0 && e->offset == start))) {
+      e->rule = 0;
+      continue;
+    }
+    if (e->offset < end || (e->offset == start && removed == 0) || inserted == removed) {
+      continue;
+    }
+    if (moved == document->movedCapacity) {
+      unsigned int capacity = moved == 0 ? 1024 : moved * 2;
+      struct MemoEntry* entries = (struct MemoEntry*)realloc(document->moved, capacity * sizeof(struct MemoEntry));
+      if (entries == 0) {
+        return 0;
+      }
+      document->moved = entries;
+      document->movedCapacity = capacity;
+    }
+    /* Неудачи раньше начала правила не бывает, такое значение означает ее отсутствие. */
+    if (e->failed >= e->offset) {
+      e->failed = e->failed - removed + inserted;
+    }
+    e->offset   = e->offset   - removed + inserted;
+    e->end      = e->end      - removed + inserted;
+    e->examined = e->examined - removed + inserted;
+    ++counts[(unsigned long)e->offset * DOCUMENT_BUCKETS / (length + 1)];
+    document->moved[moved++] = *e;
+    e->rule = 0;
+  }
+  /* Узлы лежат в арене почти в порядке их позиций в данных, поэтому результаты сдвигаются в
+     порядке смещений записей (с точностью до корзины): так память читается почти подряд, а не
+     вразброс в порядке ячеек таблицы. */
+  if (!reserveResults(&document->order, moved)) {
+    return 0;
+  }
+  for (i = 1; i <= DOCUMENT_BUCKETS; ++i) {
+    counts[i] += counts[i - 1];
+  }
+  for (i = moved; i-- > 0;) {
+    const struct MemoEntry* e = &document->moved[i];
+    document->order.items[--counts[(unsigned long)e->offset * DOCUMENT_BUCKETS / (length + 1)]] = e->result;
+  }
+  for (i = 0; i < moved; ++i) {
+    if (!shiftResult(&document->shifted, document->order.items[i], removed, inserted, buffer)) {
+      return 0;
+    }
+  }
+  /* Все узлы сдвинуты, теперь их указатели можно перенаправить на новые смещения. */
+  for (i = 0; i < document->shifted.count; ++i) {
+    struct Result* r = document->shifted.items[i];
+    r->region.begin.data = buffer + r->region.begin.offset;
+    r->region.end.data   = buffer + r->region.end.offset;
+    /* Номера строк и столбцов, если их вычисляли, после правки неверны. */
+    r->region.begin.line = r->region.begin.column = 0;
+    r->region.end.line   = r->region.end.column   = 0;
+  }
+  /* Сдвинутые записи попадают в другие ячейки и, как в rememberMemo, вытесняют оттуда только
+     записи, прочитавшие меньше данных. */
+  for (i = 0; i < moved; ++i) {
+    const struct MemoEntry* e = &document->moved[i];
+    struct MemoEntry* slot = findMemoSlot(context, e->rule - 1, e->offset);
+    if (slot->rule == 0 || slot->epoch != memo->epoch || slot->examined - slot->offset <= e->examined - e->offset) {
+      *slot = *e;
+    }
+  }
+  return 1;
+}
+/** Увеличивает таблицу мемоизации документа так, чтобы в ней было не меньше @a count ячеек.
+    Если памяти не хватает, остается прежняя таблица.
+
+@return 1, если таблица увеличена, иначе 0.
+*/
+static int growMemo(struct Context* context, unsigned long count) {
+  struct MemoEntry* entries;
+  unsigned long size = context->memo.size > 0 ? context->memo.size : 1;
+  while (size < count && size * 2 <= (~0u >> 1)) {
+    size *= 2;
+  }
+  if (size <= context->memo.size) {
+    return 0;
+  }
+  entries = (struct MemoEntry*)calloc(size, sizeof(struct MemoEntry));
+  if (entries == 0) {
+    return 0;
+  }
+  free(context->memo.entries);
+  context->memo.entries = entries;
+  context->memo.size = (unsigned int)size;
+  return 1;
+}
+/** Разбирает данные документа стартовым правилом его сессии.
+
+@param full Если не 0, результаты предыдущих разборов не используются, а их память освобождается.
+*/
+static struct Result* reparseDocument(struct Document* document, int full) {
+  struct Context* ctx = &document->session->context;
+  if (full) {
+    resetArena(ctx->arena);
+    forgetMemo(ctx);
+    /* Вытесненные записи пришлось бы разбирать заново после каждой правки, поэтому таблица
+       растет вместе с документом: сначала из расчета двух записей на PEG_MEMO_SPAN байт. */
+    growMemo(ctx, document->length / PEG_MEMO_SPAN * 2);
+  }
+  ctx->input.begin = document->buffer;
+  ctx->input.end   = document->buffer + document->length;
+  ctx->current  = 0;
+  ctx->examined = 0;
+  ctx->failed   = 0;
+  ctx->failInfo.silent = 0;
+  ctx->failInfo.pos.data = document->buffer;
+  ctx->failInfo.pos.offset = 0;
+  clearExpected(ctx);
+  document->result = document->session->func ? (*document->session->func)(ctx) : 0;
+  if (full) {
+    /* Если записей оказалось больше, чем ячеек, разбор повторяется с таблицей по их числу. */
+    if (ctx->memo.count > ctx->memo.size && growMemo(ctx, ctx->memo.count)) {
+      return reparseDocument(document, 1);
+    }
+    document->baseline = ctx->arena->used;
+  }
+  return document->result;
+}
+/** Создает документ из копии @a len байт данных @a input и разбирает его. Используется
+    генерируемой функцией createDocument.
+
+@param session Сессия, в которой будут храниться результаты разбора. Документ становится ее
+       владельцем. Если `NULL`, документ не создается.
+
+@return Новый документ или `NULL`, если не хватило памяти.
+*/
+struct Document* newDocument(struct Session* session, const char* input, unsigned int len) {
+  struct Document* d;
+  if (session == 0) {
+    return 0;
+  }
+  d = (struct Document*)calloc(1, sizeof(struct Document));
+  if (d == 0 || (d->buffer = (char*)malloc(len > 0 ? len * 2 : 1)) == 0) {
+    free(d);
+    destroySession(session);
+    return 0;
+  }
+  memcpy(d->buffer, input, len);
+  d->session  = session;
+  d->length   = len;
+  d->capacity = len > 0 ? len * 2 : 1;
+  reparseDocument(d, 1);
+  return d;
+}
+/** Возвращает результат последнего разбора документа. Он принадлежит документу и действителен
+    до следующей правки или уничтожения документа.
+*/
+struct Result* documentResult(struct Document* document) {
+  assert(document);
+  return document->result;
+}
+/** Возвращает данные документа с учетом всех правок. */
+const char* documentData(struct Document* document, unsigned int* len) {
+  assert(document);
+  if (len) {
+    *len = document->length;
+  }
+  return document->buffer;
+}
+/** Заменяет в документе @a removed байт, начиная со смещения @a offset, на @a len байт данных
+    @a inserted и разбирает его заново. Результаты правил, не прочитавших измененные данные,
+    используются повторно (результаты после правки -- со сдвинутыми позициями), поэтому заново
+    разбираются только правила, охватывающие правку.
+
+@return Новый результат разбора, константу FAILED, если разбор неудачен, или `NULL`, если не
+        хватило памяти (тогда документ не изменяется). Результат принадлежит документу и
+        действителен до следующей правки или уничтожения документа.
+*/
+struct Result* editDocument(struct Document* document, unsigned int offset, unsigned int removed, const char* inserted, unsigned int len) {
+  struct Context* ctx;
+  unsigned int length;
+  int full = 0;
+
+  assert(document);
+  assert(offset <= document->length && removed <= document->length - offset);
+  assert(inserted || len == 0);
+  ctx = &document->session->context;
+  length = document->length - removed + len;
+  if (length > document->capacity) {
+    char* buffer = (char*)realloc(document->buffer, length * 2);
+    if (buffer == 0) {
+      return 0;
+    }
+    /* Узлы результатов ссылаются на прежний буфер. */
+    full = buffer != document->buffer;
+    document->buffer   = buffer;
+    document->capacity = length * 2;
+  }
+  memmove(document->buffer + offset + len, document->buffer + offset + removed, document->length - offset - removed);
+  memcpy(document->buffer + offset, inserted, len);
+  document->length = length;
+  ctx->input.begin = document->buffer;
+
+  if (!full) {
+    full = ctx->arena->used > (DOCUMENT_GARBAGE + 1) * document->baseline
+        || !shiftMemo(document, offset, removed, len);
+  }
+  return reparseDocument(document, full);
+}
+/** Возвращает информацию об ошибке последнего разбора документа. Она действительна до следующей
+    правки или уничтожения документа. Позиция ошибки та же, что и при полном разборе: повторно
+    используемые результаты правил воспроизводят свои неудачи. Но ожидаемые элементы собираются
+    только из правил, разобранных заново, поэтому их список может быть короче.
+*/
+const struct FailInfo* documentFailInfo(struct Document* document) {
+  assert(document);
+  return sessionFailInfo(document->session);
+}
+/** Уничтожает документ вместе с его данными и всеми результатами разбора. */
+void destroyDocument(struct Document* document) {
+  if (document) {
+    destroySession(document->session);
+    free(document->buffer);
+    free(document->moved);
+    free((void*)document->order.items);
+    free((void*)document->shifted.items);
+    free(document);
+  }
+}
+#ifdef PEG_THREADS
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/* Параллельный разбор. */
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/* Разбор реентерабелен: все изменяемое состояние находится в контексте (и в сессии, которой он
+   принадлежит), а общие для всех разборов таблицы парсера и константы FAILED и NIL только
+   читаются. Поэтому каждый поток разбирает данные в своей сессии без какой-либо синхронизации.
+   Исключение -- пользовательский код действий. Счетчики профилирования (PEG_PROFILE) каждая сессия
+   ведет в своей таблице и переносит в общую таблицу парсера под блокировкой при уничтожении. */
+#include <pthread.h>
+#include <unistd.h>
+
+/** Минимальный размер части данных при разбиении их на части для параллельного разбора. */
+#ifndef PEG_MIN_CHUNK
+#  define PEG_MIN_CHUNK 65536u
+#endif
+/** Количество частей данных на один поток. Частей больше, чем потоков, чтобы освободившиеся
+    потоки могли забирать части у занятых.
+*/
+#define CHUNKS_PER_THREAD 4
+/** Байт, после которого начинается часть данных. Если запись не может начаться сразу после него,
+    это только замедляет разбор (часть разбирается повторно), но не влияет на результат.
+*/
+#ifndef PEG_CHUNK_SYNC
+#  define PEG_CHUNK_SYNC '\n'
+#endif
+
+/** Функция, создающая сессию разбора. Используется генерируемая функция createSession. */
+typedef struct Session* (*SessionFactory)(void* data);
+/** Функция выполнения задачи @a task в сессии @a session. Ненулевой результат прекращает
+    выполнение остальных задач.
+*/
+typedef int (*TaskFunc)(void* data, struct Session* session, unsigned int task);
+
+struct Pool;
+/** Поток пула со своей сессией и своей очередью задач. Очередь -- непрерывный диапазон номеров
+    задач: поток берет задачи из его начала, а освободившиеся потоки забирают половину из конца.
+*/
+struct Worker {
+  /** Защищает диапазон задач. */
+  pthread_mutex_t lock;
+  /** Номер следующей задачи потока. */
+  unsigned int next;
+  /** Номер, следующий за последней задачей потока. */
+  unsigned int end;
+  /** Сессия, в которой поток разбирает данные. */
+  struct Session* session;
+  struct Pool* pool;
+  pthread_t thread;
+};
+struct Pool {
+  /** Потоки пула. Первый из них -- вызывающий поток. */
+  struct Worker* workers;
+  /** Количество потоков. */
+  unsigned int count;
+  TaskFunc func;
+  void* data;
+  /** Защищает флаг stop. */
+  pthread_mutex_t lock;
+  /** Ненулевое значение, если выполнение задач прекращено. */
+  int stop;
+};
+/** Возвращает количество потоков для @a tasks задач: @a threads или, если оно равно 0, количество
+    процессоров, но не больше количества задач и не меньше 1.
+*/
+static unsigned int threadCount(unsigned int threads, unsigned int tasks) {
+  if (threads == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = n > 0 ? (unsigned int)n : 1;
+#else
+    threads = 1;
+#endif
+  }
+  if (threads > tasks) {
+    threads = tasks;
+  }
+  return threads > 0 ? threads : 1;
+}
+/** Берет очередную задачу потока @a w, а если его очередь пуста, забирает половину очереди
+    другого потока.
+
+@return 1, если задача взята, 0, если задач больше нет.
+*/
+static int takeTask(struct Worker* w, unsigned int* task) {
+  struct Pool* pool = w->pool;
+  unsigned int self = (unsigned int)(w - pool->workers);
+  unsigned int i;
+
+  pthread_mutex_lock(&w->lock);
+  if (w->next < w->end) {
+    *task = w->next++;
+    pthread_mutex_unlock(&w->lock);
+    return 1;
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  for (i = 1; i < pool->count; ++i) {
+    struct Worker* victim = &pool->workers[(self + i) % pool->count];
+    unsigned int half;
+
+    pthread_mutex_lock(&victim->lock);
+    half = (victim->end - victim->next + 1) / 2;
+    if (half > 0) {
+      unsigned int first;
+      victim->end -= half;
+      first = victim->end;
+      pthread_mutex_unlock(&victim->lock);
+
+      /* Очередь этого потока пуста, поэтому другие потоки ничего не заберут из нее, пока
+         она не заполнена. */
+      pthread_mutex_lock(&w->lock);
+      w->next = first + 1;
+      w->end  = first + half;
+      pthread_mutex_unlock(&w->lock);
+      *task = first;
+      return 1;
+    }
+    pthread_mutex_unlock(&victim->lock);
+  }
+  return 0;
+}
+static int isStopped(struct Pool* pool) {
+  int stop;
+  pthread_mutex_lock(&pool->lock);
+  stop = pool->stop;
+  pthread_mutex_unlock(&pool->lock);
+  return stop;
+}
+static void* runWorker(void* arg) {
+  struct Worker* w = (struct Worker*)arg;
+  struct Pool* pool = w->pool;
+  unsigned int task;
+
+  while (!isStopped(pool) && takeTask(w, &task)) {
+    if ((*pool->func)(pool->data, w->session, task)) {
+      pthread_mutex_lock(&pool->lock);
+      pool->stop = 1;
+      pthread_mutex_unlock(&pool->lock);
+    }
+  }
+  return 0;
+}
+/** Выполняет @a tasks задач в @a count потоках, каждый из которых использует свою сессию из
+    массива @a sessions. Один из потоков -- вызывающий. Если поток не удалось запустить, его
+    задачи выполняют остальные.
+
+@return 1, если выполнение прекращено функцией задачи, 0, если выполнены все задачи, или -1,
+        если не хватило памяти.
+*/
+static int runPool(struct Session** sessions, unsigned int count, unsigned int tasks, TaskFunc func, void* data) {
+  struct Pool pool;
+  unsigned int i;
+  int* started;
+
+  pool.workers = (struct Worker*)calloc(count, sizeof(struct Worker));
+  started = (int*)calloc(count, sizeof(int));
+  if (pool.workers == 0 || started == 0) {
+    free(pool.workers);
+    free(started);
+    return -1;
+  }
+  pool.count = count;
+  pool.func  = func;
+  pool.data  = data;
+  pool.stop  = 0;
+  pthread_mutex_init(&pool.lock, 0);
+  for (i = 0; i < count; ++i) {
+    struct Worker* w = &pool.workers[i];
+    pthread_mutex_init(&w->lock, 0);
+    w->next    = (unsigned int)((unsigned long)tasks * i / count);
+    w->end     = (unsigned int)((unsigned long)tasks * (i + 1) / count);
+    w->session = sessions[i];
+    w->pool    = &pool;
+  }
+  for (i = 1; i < count; ++i) {
+    started[i] = pthread_create(&pool.workers[i].thread, 0, &runWorker, &pool.workers[i]) == 0;
+  }
+  runWorker(&pool.workers[0]);
+  for (i = 1; i < count; ++i) {
+    if (started[i]) {
+      pthread_join(pool.workers[i].thread, 0);
+    }
+  }
+  for (i = 0; i < count; ++i) {
+    pthread_mutex_destroy(&pool.workers[i].lock);
+  }
+  pthread_mutex_destroy(&pool.lock);
+  free(pool.workers);
+  free(started);
+  return pool.stop;
+}
+/** Уничтожает @a count сессий массива @a sessions и сам массив. */
+static void destroySessions(struct Session** sessions, unsigned int count) {
+  unsigned int i;
+  if (sessions) {
+    for (i = 0; i < count; ++i) {
+      destroySession(sessions[i]);
+    }
+    free(sessions);
+  }
+}
+/** Создает @a count сессий, разбирающих данные правилом @a func.
+
+@return Массив сессий или `NULL`, если не хватило памяти. Массив уничтожается функцией
+        destroySessions.
+*/
+static struct Session** createSessions(SessionFactory create, RuleFunc func, void* data, unsigned int count) {
+  struct Session** sessions = (struct Session**)calloc(count, sizeof(struct Session*));
+  unsigned int i;
+  if (sessions == 0) {
+    return 0;
+  }
+  for (i = 0; i < count; ++i) {
+    sessions[i] = (*create)(data);
+    if (sessions[i] == 0) {
+      destroySessions(sessions, count);
+      return 0;
+    }
+    sessions[i]->func = func;
+  }
+  return sessions;
+}
+
+struct BatchJob {
+  const struct Range* inputs;
+  BatchFunc onResult;
+  void* data;
+};
+static int parseBatchItem(void* data, struct Session* session, unsigned int index) {
+  struct BatchJob* job = (struct BatchJob*)data;
+  const struct Range* input = &job->inputs[index];
+  struct Result* result = parseSession(session, input->begin, (unsigned int)(input->end - input->begin));
+  return (*job->onResult)(job->data, index, result, session);
+}
+/** Разбирает @a count независимых входных данных @a inputs правилом @a func в @a threads потоках
+    (0 -- по количеству процессоров), передавая каждый результат в функцию @a onResult.
+    Используется генерируемой функцией parseBatch.
+
+@return Одно из значений E_BATCH_STATUS.
+*/
+int runBatch(SessionFactory create, RuleFunc func, unsigned int threads, const struct Range* inputs, unsigned int count, BatchFunc onResult, void* data) {
+  struct BatchJob job;
+  struct Session** sessions;
+  int stop;
+
+  assert(inputs || count == 0);
+  assert(onResult);
+  if (count == 0) {
+    return E_BATCH_OK;
+  }
+  threads  = threadCount(threads, count);
+  sessions = createSessions(create, func, data, threads);
+  if (sessions == 0) {
+    return E_BATCH_NO_MEMORY;
+  }
+  job.inputs   = inputs;
+  job.onResult = onResult;
+  job.data     = data;
+  stop = runPool(sessions, threads, count, &parseBatchItem, &job);
+  destroySessions(sessions, threads);
+  return stop < 0 ? E_BATCH_NO_MEMORY : stop ? E_BATCH_STOPPED : E_BATCH_OK;
+}
+
+/** Часть данных, записи которой разобраны заранее, в предположении, что с ее начала
+    начинается запись.
+*/
+struct Chunk {
+  /** Смещение начала части. */
+  unsigned int from;
+  /** Смещение конца части: в нее входят записи, начинающиеся до него. */
+  unsigned int to;
+  /** Смещение конца последней разобранной записи. Если меньше to, очередную запись разобрать
+      не удалось.
+  */
+  unsigned int end;
+  /** Количество разобранных записей. */
+  unsigned int count;
+  /** Емкость массивов records и starts. */
+  unsigned int capacity;
+  /** Записи части в порядке следования. Память узлов принадлежит сессии, разбиравшей часть. */
+  struct Result** records;
+  /** Смещения начал записей, по возрастанию. */
+  unsigned int* starts;
+  /** Ненулевое значение, если записи не удалось сохранить из-за нехватки памяти. */
+  int broken;
+};
+/** Разбирает записи правилом сессии, начиная с позиции @a from, пока очередная запись
+    начинается раньше @a to, передавая каждую в функцию @a onRecord. Записи видят все данные
+    @a input, поэтому разбираются так же, как при последовательном разборе с той же позиции.
+
+@param reuse Если не 0, память каждой записи освобождается после обработки.
+@param stopped Устанавливается в 1, если функция @a onRecord вернула ненулевое значение.
+
+@return Смещение конца последней разобранной записи.
+*/
+static unsigned int parseRecordRun(struct Session* session, const struct Range* input, unsigned int from, unsigned int to, RecordFunc onRecord, void* data, int reuse, int* stopped) {
+  struct Context* ctx = &session->context;
+
+  ctx->input.begin = input->begin;
+  ctx->input.end   = input->end;
+  ctx->current = from;
+  ctx->failInfo.silent = 0;
+  ctx->failInfo.pos.data = input->begin + from;
+  ctx->failInfo.pos.offset = from;
+  clearExpected(ctx);
+  forgetMemo(ctx);
+  while (ctx->current < to) {
+    unsigned int start = ctx->current;
+    struct Result* record = (*session->func)(ctx);
+    /* Запись, не продвинувшая позицию, как и неудачная, завершает повторение. */
+    if (isFailed(record) || ctx->current == start) {
+      ctx->current = start;
+      break;
+    }
+    if ((*onRecord)(data, record, start)) {
+      *stopped = 1;
+      break;
+    }
+    if (reuse) {
+      forgetMemo(ctx);
+      resetArena(ctx->arena);
+    }
+  }
+  return ctx->current;
+}
+static int storeRecord(void* data, struct Result* record, unsigned long offset) {
+  struct Chunk* chunk = (struct Chunk*)data;
+  if (chunk->count == chunk->capacity) {
+    unsigned int capacity = chunk->capacity == 0 ? 64 : chunk->capacity * 2;
+    struct Result** records = (struct Result**)realloc(chunk->records, capacity * sizeof(struct Result*));
+    unsigned int* starts;
+    if (records == 0) {
+      chunk->broken = 1;
+      return 1;
+    }
+    chunk->records = records;
+    starts = (unsigned int*)realloc(chunk->starts, capacity * sizeof(unsigned int));
+    if (starts == 0) {
+      chunk->broken = 1;
+      return 1;
+    }
+    chunk->starts   = starts;
+    chunk->capacity = capacity;
+  }
+  chunk->records[chunk->count] = record;
+  chunk->starts[chunk->count]  = (unsigned int)offset;
+  ++chunk->count;
+  return 0;
+}
+struct ChunkJob {
+  const struct Range* input;
+  struct Chunk* chunks;
+};
+static int parseChunk(void* data, struct Session* session, unsigned int index) {
+  struct ChunkJob* job = (struct ChunkJob*)data;
+  struct Chunk* chunk = &job->chunks[index];
+  int stopped = 0;
+  /* Записи всех частей, разобранных сессией, должны дожить до объединения, поэтому память
+     между частями не освобождается. */
+  chunk->end = parseRecordRun(session, job->input, chunk->from, chunk->to, &storeRecord, chunk, 0, &stopped);
+  return 0;
+}
+/** Ищет запись части, начинающуюся в позиции @a pos.
+
+@return Индекс записи или количество записей части, если такой записи нет.
+*/
+static unsigned int findChunkRecord(const struct Chunk* chunk, unsigned int pos) {
+  unsigned int lo = 0;
+  unsigned int hi = chunk->count;
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (chunk->starts[mid] < pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < chunk->count && chunk->starts[lo] == pos ? lo : chunk->count;
+}
+/** Разбирает данные @a input, состоящие из последовательности записей правила @a func,
+    параллельно в @a threads потоках (0 -- по количеству процессоров) и передает записи в функцию
+    @a onRecord по порядку из вызывающего потока. Используется генерируемой функцией parseChunked.
+
+Данные делятся на части, начинающиеся после байта PEG_CHUNK_SYNC, и записи каждой части
+разбираются независимо. Затем части объединяются: если последовательный разбор приходит в
+позицию, с которой в части начинается запись, используются записи части, иначе (граница части
+пришлась на середину записи) записи разбираются заново с этой позиции. Поэтому результат всегда
+совпадает с последовательным разбором, но действия грамматики могут выполниться и для
+отброшенных записей.
+
+@param failInfo Если не `NULL`, при результате E_BATCH_FAILED сюда записывается информация об
+       ошибке разбора записи. Массив `expected` необходимо освободить функцией `free`.
+
+@return Одно из значений E_BATCH_STATUS.
+*/
+int runChunked(SessionFactory create, RuleFunc func, unsigned int threads, const struct Range* input, RecordFunc onRecord, void* data, struct FailInfo* failInfo) {
+  unsigned int len = (unsigned int)(input->end - input->begin);
+  unsigned int count, i;
+  unsigned int pos = 0;
+  int stopped = 0;
+  int status;
+  struct Chunk* chunks;
+  struct Session** sessions;
+  struct Session* repair;
+  struct ChunkJob job;
+
+  assert(input);
+  assert(onRecord);
+  count   = threadCount(threads, (len + PEG_MIN_CHUNK - 1) / PEG_MIN_CHUNK);
+  threads = count;
+  count  *= count > 1 ? CHUNKS_PER_THREAD : 1;
+  /* Последняя сессия служит для повторного разбора записей при объединении частей. */
+  sessions = createSessions(create, func, data, threads + 1);
+  chunks   = (struct Chunk*)calloc(count, sizeof(struct Chunk));
+  if (sessions == 0 || chunks == 0) {
+    destroySessions(sessions, threads + 1);
+    free(chunks);
+    return E_BATCH_NO_MEMORY;
+  }
+  repair = sessions[threads];
+  for (i = 0; i < count; ++i) {
+    unsigned int from = (unsigned int)((unsigned long)len * i / count);
+    const char* sync;
+    if (i > 0) {
+      sync = (const char*)memchr(input->begin + from, PEG_CHUNK_SYNC, len - from);
+      from = sync ? (unsigned int)(sync - input->begin) + 1 : len;
+      /* Части не должны пересекаться, даже если байт синхронизации встретился нескоро. */
+      from = from > chunks[i - 1].from ? from : chunks[i - 1].from;
+      chunks[i - 1].to = from;
+    }
+    chunks[i].from = from;
+    chunks[i].to   = len;
+  }
+  job.input  = input;
+  job.chunks = chunks;
+  if (count > 1 && runPool(sessions, threads, count, &parseChunk, &job) < 0) {
+    /* Без потоков все части разберутся при объединении. */
+    for (i = 0; i < count; ++i) {
+      chunks[i].broken = 1;
+    }
+  }
+
+  for (i = 0; i < count && !stopped; ++i) {
+    struct Chunk* chunk = &chunks[i];
+    unsigned int k;
+    /* Часть целиком покрыта записями предыдущих частей. */
+    if (pos >= chunk->to) {
+      continue;
+    }
+    k = count > 1 && !chunk->broken ? findChunkRecord(chunk, pos) : chunk->count;
+    if (k < chunk->count) {
+      for (; k < chunk->count; ++k) {
+        if ((*onRecord)(data, chunk->records[k], chunk->starts[k])) {
+          stopped = 1;
+          break;
+        }
+      }
+      pos = chunk->end;
+    } else {
+      pos = parseRecordRun(repair, input, pos, chunk->to, onRecord, data, 1, &stopped);
+    }
+    /* Последовательный разбор остановился бы на той же записи. */
+    if (pos < chunk->to) {
+      break;
+    }
+  }
+
+  if (stopped) {
+    status = E_BATCH_STOPPED;
+  } else if (pos < len) {
+    status = E_BATCH_FAILED;
+    if (failInfo) {
+      /* Информация об ошибке относится к записи, которую не удалось разобрать. */
+      struct Context* ctx = &repair->context;
+      parseRecordRun(repair, input, pos, pos + 1, onRecord, data, 1, &stopped);
+      collectExpected(ctx);
+      memcpy(failInfo, &ctx->failInfo, sizeof(struct FailInfo));
+      ctx->failInfo.expected = 0;
+      ctx->failInfo.count    = 0;
+      ctx->failInfo.capacity = 0;
+    }
+  } else {
+    status = E_BATCH_OK;
+  }
+  for (i = 0; i < count; ++i) {
+    free(chunks[i].records);
+    free(chunks[i].starts);
+  }
+  free(chunks);
+  destroySessions(sessions, threads + 1);
+  return status;
+}
+#endif
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/* Правила разбора примитивов. */
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/** Если в разбираемых данных еще не достигнут конец, продвигает текущую позицию на один символ
+    вперед. В случае неудачи позиция остается неизменной.
+
+@param context Информация о разбираемом участке и текущей в нем позиции.
+
+@return Константу NIL, если разбор успешен, или константу FAILED, если разбор неудачен.
+*/
+struct Result* skipAny(struct Context* context) {
+  if (available(context, 1)) {
+    movePos(context, 1);
+    return &NIL;
+  } else {
+    return fail(context, &ANY_EXPECTED);
+  }
+}
+/** Если в разбираемых данных еще не достигнут конец, продвигает текущую позицию на один символ
+    вперед и возвращает результат с границами от текущей позиции до текущей позиции плюс 1.
+    В случае неудачи позиция остается неизменной и возвращается константа FAILED.
+
+@param context Информация о разбираемом участке и текущей в нем позиции.
+
+@return Результат разбора или константу FAILED, если разбор неудачен. Результат необходимо
+        освободить функцией freeResult, когда он больше не будет нужен.
+*/
+struct Result* parseAny(struct Context* context) {
+  const char* begin = context->input.begin + context->current;
+
+  if (isFailed(skipAny(context))) {
+    return &FAILED;
+  }
+  return allocResult(context, begin, begin + 1, 0);
+}
+/** Если указанная строка @a literal является подстрокой разбираемых данных, начиная с текущей
+    позиции разбора, то продвигает текущую позицию на величину @a len, не создавая результат.
+    В случае неудачи позиция остается неизменной.
+
+@return Константу NIL, если разбор успешен, или константу FAILED, если разбор неудачен.
+*/
+struct Result* skipLiteral(struct Context* context, const struct Literal* literal, const struct Expected* expected) {
+  assert(context);
+  assert(literal);
+  assert(expected);
+  if (matchLiteral(context, literal)) {
+    movePos(context, literal->len);
+    return &NIL;
+  } else {
+    return fail(context, expected);
+  }
+}
+/** Если указанная строка @a literal является подстрокой разбираемых данных, начиная с текущей
+    позиции разбора, то продвигает текущую позицию на величину @a len и возвращает результат с
+    границами от текущей позиции до текущей позиции плюс @a len.
+    В случае неудачи позиция остается неизменной и возвращается константа FAILED.
+
+@param context Информация о разбираемом участке и текущей в нем позиции.
+@param literal Литерал, с которым осуществляется сопоставление разбираемых данных.
+
+@return Результат разбора или константу FAILED, если разбор неудачен. Результат необходимо
+        освободить функцией freeResult, когда он больше не будет нужен.
+*/
+struct Result* parseLiteral(struct Context* context, const struct Literal* literal, const struct Expected* expected) {
+  const char* begin = context->input.begin + context->current;
+
+  if (isFailed(skipLiteral(context, literal, expected))) {
+    return &FAILED;
+  }
+  return allocResult(context, begin, begin + literal->len, 0);
+}
+/** Если текущий символ входит в класс @a cls, продвигает текущую позицию на один символ вперед,
+    не создавая результат. В случае неудачи позиция остается неизменной.
+
+@return Константу NIL, если разбор успешен, или константу FAILED, если разбор неудачен.
+*/
+struct Result* skipCharClass(struct Context* context, const struct CharClass* cls, const struct Expected* expected) {
+  assert(context);
+  assert(cls);
+  assert(expected);
+  if (matchCharClass(context, cls)) {
+    movePos(context, 1);
+    return &NIL;
+  } else {
+    return fail(context, expected);
+  }
+}
+struct Result* parseCharClass(struct Context* context, const struct CharClass* cls, const struct Expected* expected) {
+  const char* begin = context->input.begin + context->current;
+
+  if (isFailed(skipCharClass(context, cls, expected))) {
+    return &FAILED;
+  }
+  return allocResult(context, begin, begin + 1, 0);
+}
+/** Пропускает повторение класса символов от @a min до @a max раз, не создавая результат. Конец
+    последовательности байтов класса ищется функцией spanCharClass.
+
+@param context Информация о разбираемом участке и текущей в нем позиции.
+@param cls Класс символов.
+@param expected Сообщение об ожидаемом элементе, если очередной байт не входит в класс.
+@param min Минимальное количество повторений.
+@param max Максимальное количество повторений или 0, если оно не ограничено.
+
+@return Константу NIL, если разбор успешен, или константу FAILED, если повторений меньше @a min.
+*/
+struct Result* skipCharClassRun(struct Context* context, const struct CharClass* cls, const struct Expected* expected, unsigned int min, unsigned int max) {
+  unsigned int start;
+  const char* begin;
+  const char* end;
+  unsigned int count;
+  assert(context);
+  assert(cls);
+  assert(expected);
+
+  start = context->current;
+  begin = context->input.begin + context->current;
+  count = 0;
+  do {
+    end = context->input.end;
+    if (max != 0 && (unsigned int)(end - begin) > max) {
+      end = begin + max;
+    }
+    count += spanCharClass(cls, begin + count, end);
+    /* Байты класса дошли до конца прочитанных данных -- их может быть больше в потоке. */
+  } while ((max == 0 || count < max) && begin + count == context->input.end && available(context, count + 1));
+  /* Если повторение не дошло до максимума, прочитан и первый неподходящий байт. */
+  PEG_EXAMINE(context, start + count + (max == 0 || count < max));
+  movePos(context, count);
+  /* Повторение останавливается либо на максимуме, либо на первом неподходящем байте, о чем
+  и надо сообщить, как это сделал бы очередной вызов parseCharClass. */
+  if (max == 0 || count < max) {
+    fail(context, expected);
+  }
+  if (count < min) {
+    PEG_BACKTRACK(context, start);
+    context->current = start;
+    return &FAILED;
+  }
+  return &NIL;
+}
+/** Разбирает повторение класса символов от @a min до @a max раз. Результат такой же, как у
+    повторения с помощью parseCharClass, но конец последовательности байтов класса ищется
+    функцией spanCharClass, а узлы для отдельных байтов создаются уже после этого.
+
+@param context Информация о разбираемом участке и текущей в нем позиции.
+@param cls Класс символов.
+@param expected Сообщение об ожидаемом элементе, если очередной байт не входит в класс.
+@param min Минимальное количество повторений.
+@param max Максимальное количество повторений или 0, если оно не ограничено.
+
+@return Массив результатов разбора отдельных байтов или константу FAILED, если повторений меньше
+        @a min. Результат необходимо освободить функцией freeResult, когда он больше не будет нужен.
+*/
+struct Result* parseCharClassRun(struct Context* context, const struct CharClass* cls, const struct Expected* expected, unsigned int min, unsigned int max) {
+  const char* begin = context->input.begin + context->current;
+  struct Result* r;
+  unsigned int count;
+  unsigned int i;
+
+  if (isFailed(skipCharClassRun(context, cls, expected, min, max))) {
+    return &FAILED;
+  }
+  count = (unsigned int)(context->input.begin + context->current - begin);
+  r = allocResult(context, begin, begin + count, count);
+  for (i = 0; i < count; ++i) {
+    r->childs[i] = allocResult(context, begin + i, begin + i + 1, 0);
+  }
+  return r;
+}
+/** Выбирает по текущему байту первую альтернативу выражения выбора, которая может завершиться
+    успешно, и сообщает об ожидаемых элементах всех пропущенных перед ней альтернатив так же,
+    как это сделали бы их неудачные попытки разбора.
+
+@param context Информация о разбираемом участке и текущей в нем позиции.
+@param dispatch Таблица выбора, построенная генератором для данного выражения.
+
+@return Номер альтернативы, с которой нужно начать разбор.
+*/
+unsigned int dispatch(struct Context* context, const struct Dispatch* dispatch) {
+  const char* begin;
+  unsigned int k;
+  unsigned int i;
+  const struct Expected* const* e;
+  assert(context);
+  assert(dispatch);
+
+  begin = context->input.begin + context->current;
+  k = dispatch->first[available(context, 1) ? (unsigned char)*begin : 256];
+  /* fail все равно ничего не запомнит, если сообщения подавлены или уже есть ошибка дальше
+     (а при инкрементальном разборе -- еще и правило уже сообщало неудачу не ближе). */
+  if (context->failInfo.silent != 0 || (context->current < context->failInfo.pos.offset
+#ifdef PEG_INCREMENTAL
+      && context->current <= context->failed
+#endif
+  )) {
+    return k;
+  }
+  for (i = 0, e = dispatch->expected; i < k; ++i, ++e) {
+    for (; *e != 0; ++e) {
+      fail(context, *e);
+    }
+  }
+  return k;
+}
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+struct Result* wrap(struct Context* context, unsigned int pos, unsigned int count, ...) {
+  struct Result* r;
+  unsigned int i;
+
+  va_list results;
+  va_start(results, count);
+
+  r = allocResult(context, context->input.begin + pos, context->input.begin + context->current, count);
+  for (i = 0; i < count; ++i) {
+    assert(r->childs);
+    r->childs[i] = va_arg(results, struct Result*);
+    assert(r->childs[i]);
+  }
+
+  va_end(results);
+  return r;
+}
+/** Создает результат без потомков, охватывающий данные от позиции @a pos до текущей позиции. */
+struct Result* _text(struct Context* context, unsigned int pos) {
+  return allocResult(context, context->input.begin + pos, context->input.begin + context->current, 0);
+}
+static int findRuleCompatator(const struct Range* name, const struct ParseFunc* entry) {
+  unsigned int len;
+  assert(name);
+  assert(name->begin);
+  assert(name->end);
+  assert(entry);
+  len = name->end - name->begin;
+  if (len < entry->len) { return -1; }
+  if (len > entry->len) { return +1; }
+  return memcmp(name->begin, entry->name, len);
+}
+const struct ParseFunc* findRule(const struct ParseFunc* table, size_t count, const struct Range* name) {
   typedef int (*Comparator)(const void*, const void*);
   assert(table);
   assert(name);
@@ -269,4 +2198,104 @@ const struct ParseFunc* findRule(const struct ParseFunc* table, size_t count, co
     name, table, count, sizeof(table[0]),
     (Comparator)&findRuleCompatator
   );
-}
\ No newline at end of file
+}
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/* Плоское дерево результата. */
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static unsigned int countNodes(const struct Result* result) {
+  unsigned int n = 1;
+  unsigned int i;
+  for (i = 0; i < result->count; ++i) {
+    n += countNodes(result->childs[i]);
+  }
+  return n;
+}
+/** Переносит дерево результата @a root в плоское дерево @a tree. Узлы раскладываются в порядке
+    обхода в ширину, поэтому потомки каждого узла оказываются в массиве рядом. Исходное дерево
+    не изменяется и может быть освобождено сразу после вызова.
+
+@return Ненулевое значение, если дерево построено, 0, если не хватило памяти. Дерево необходимо
+        освободить функцией freeFlatTree.
+*/
+int flattenResult(const struct Result* root, struct FlatTree* tree) {
+  const struct Result** queue;
+  unsigned int count;
+  unsigned int tail;
+  unsigned int i;
+  assert(root);
+  assert(tree);
+  assert(!isFailed(root));
+
+  count = countNodes(root);
+  tree->count = 0;
+  tree->nodes = (struct FlatNode*)malloc(count * sizeof(struct FlatNode));
+  /* Узлы исходного дерева, соответствующие элементам массива, нужны только до конца обхода. */
+  queue = (const struct Result**)malloc(count * sizeof(struct Result*));
+  if (tree->nodes == 0 || queue == 0) {
+    free(tree->nodes);
+    free((void*)queue);
+    tree->nodes = 0;
+    return 0;
+  }
+  queue[0] = root;
+  tail = 1;
+  for (i = 0; i < count; ++i) {
+    const struct Result* r = queue[i];
+    struct FlatNode* n = &tree->nodes[i];
+    unsigned int j;
+    n->begin = isNil(r) ? 0 : r->region.begin.offset;
+    n->end   = isNil(r) ? 0 : r->region.end.offset;
+    n->kind  = isNil(r) ? FLAT_NIL : r->kind;
+    n->first = tail;
+    n->count = r->count;
+    for (j = 0; j < r->count; ++j) {
+      queue[tail++] = r->childs[j];
+    }
+  }
+  free((void*)queue);
+  tree->count = count;
+  return 1;
+}
+/** Освобождает все узлы плоского дерева одним вызовом. */
+void freeFlatTree(struct FlatTree* tree) {
+  assert(tree);
+  free(tree->nodes);
+  tree->count = 0;
+  tree->nodes = 0;
+}
+/** Возвращает @a i-го потомка узла @a node плоского дерева @a tree. */
+const struct FlatNode* flatChild(const struct FlatTree* tree, const struct FlatNode* node, unsigned int i) {
+  assert(tree);
+  assert(node);
+  assert(i < node->count);
+  return &tree->nodes[node->first + i];
+}
+/** Разбирает данные правилом @a func, размещая промежуточное дерево в собственной арене, и
+    переносит результат в плоское дерево @a tree. Арена уничтожается сразу после переноса,
+    так что после возврата в памяти остается только массив узлов.
+
+@return Ненулевое значение, если разбор успешен и дерево построено.
+*/
+int parseFlatTree(struct Context* context, RuleFunc func, struct FlatTree* tree) {
+  struct Arena* arena;
+  struct Result* r;
+  int ok;
+  assert(context);
+  assert(func);
+  assert(tree);
+
+  tree->count = 0;
+  tree->nodes = 0;
+  arena = createArena();
+  if (arena == 0) {
+    return 0;
+  }
+  context->arena = arena;
+  r = (*func)(context);
+  ok = !isFailed(r) && flattenResult(r, tree);
+  /* Таблица мемоизации ссылается на узлы арены, поэтому освобождается раньше нее. */
+  freeMemo(context);
+  context->arena = 0;
+  destroyArena(arena);
+  return ok;
+}
@@ -36,10 +36,11 @@ struct Location {
   /** Смещение в элементах от начала разбираемых данных, нумерация с 0. */
   unsigned int offset;
   /** Номер строки в разбираемых данных, нумерация с 1. Новая строка начинается после символа
-      '\r', '\n' или пары символов '\r\n'.
+      '\r', '\n' или пары символов '\r\n'. Во время разбора не отслеживается, вычисляется по
+      запросу функцией resolveLocation.
   */
   unsigned int line;
-  /** Номер столбца в строке разбираемых данных, нумерация с 1. */
+  /** Номер столбца в строке разбираемых данных, нумерация с 1. Вычисляется вместе с номером строки. */
   unsigned int column;
 };
 struct Region {
@@ -58,6 +59,17 @@ struct Result {
   unsigned int count;
   /** Указатель на потомков данного узла. */
   struct Result** childs;
+  /** Количество ссылок на данный узел. Узел может одновременно принадлежать дереву разбора и
+      таблице мемоизации, поэтому память под него освобождается только тогда, когда счетчик
+      обнулится. У узлов, выделенных в @link Arena арене@endlink, счетчик всегда равен 0 --
+      они освобождаются только вместе с ареной.
+  */
+  unsigned int refs;
+  /** Номер правила грамматики, увеличенный на 1, результатом разбора которого является узел,
+      или 0, если узел создан не правилом, а выражением внутри него. Если несколько правил
+      возвращают один и тот же узел (`a = b`), в нем остается номер самого вложенного из них.
+  */
+  unsigned int kind;
 };
 enum E_EXPECTED_TYPE {
   /** Ожидается любой символ. */
@@ -74,6 +86,8 @@ enum E_EXPECTED_TYPE {
 struct Expected {
   unsigned int typeAndLen;
   const char* message;
+  /** Номер элемента среди всех ожидаемых элементов парсера, от 0 и без пропусков. */
+  unsigned int id;
 };
 struct FailInfo {
   unsigned int silent;
@@ -81,21 +95,254 @@ struct FailInfo {
   struct Location pos;
   /** Количество элементов Expected в массиве expected. */
   unsigned int count;
-  /** Массив возможных ожидаемых значений в позиции failPos. */
+  /** Массив возможных ожидаемых значений в позиции failPos без повторов, упорядоченный по их
+      номерам. Заполняется не во время разбора, а только по запросу информации об ошибке.
+  */
   const struct Expected** expected;
+  /** Количество элементов, под которое выделена память в массиве expected. */
+  unsigned int capacity;
+};
+/** Множество ожидаемых элементов в позиции ошибки, в котором каждому элементу соответствует бит
+    с его номером. Во время разбора ошибки запоминаются только в нем, без выделения памяти.
+*/
+struct ExpectedSet {
+  /** Все ожидаемые элементы парсера, индекс в массиве совпадает с номером элемента. */
+  const struct Expected* const* table;
+  /** Количество элементов в массиве table. */
+  unsigned int count;
+  /** Биты множества, по одному на каждый элемент массива table. */
+  unsigned long* bits;
+};
+/** Сессия разбора: контекст, арена и таблица мемоизации, которые создаются один раз и
+    используются повторно при каждом разборе. Определение структуры внутреннее.
+*/
+struct Session;
+/** Документ для инкрементального разбора: данные вместе с результатами разбора всех правил,
+    которые после правки данных используются повторно там, где правка их не затронула.
+    Определение структуры внутреннее.
+*/
+struct Document;
+/** Индекс начал строк разбираемых данных для вычисления номеров строк и столбцов по смещению.
+    Данные просматриваются не сразу, а по мере обращения к все более далеким позициям.
+*/
+struct LineIndex {
+  /** Начало индексируемых данных. */
+  const char* begin;
+  /** Конец индексируемых данных. */
+  const char* end;
+  /** Граница уже просмотренных данных: все начала строк до нее есть в массиве starts. */
+  const char* scanned;
+  /** Количество найденных начал строк. */
+  unsigned int count;
+  /** Емкость массива starts. */
+  unsigned int capacity;
+  /** Отсортированный массив смещений начал строк от начала данных. */
+  unsigned int* starts;
+};
+/** Значение поля @link FlatNode::kind kind@endlink для узла, соответствующего константе NIL. */
+#define FLAT_NIL 0xFFFFFFFFu
+/** Узел плоского дерева результата. */
+struct FlatNode {
+  /** Смещение начала узла от начала разбираемых данных. */
+  unsigned int begin;
+  /** Смещение конца узла от начала разбираемых данных. */
+  unsigned int end;
+  /** Номер правила, увеличенный на 1 (см. @link Result::kind@endlink), 0 или FLAT_NIL. */
+  unsigned int kind;
+  /** Индекс первого потомка в массиве узлов дерева. Потомки узла идут в массиве подряд. */
+  unsigned int first;
+  /** Количество потомков узла. */
+  unsigned int count;
+};
+/** Дерево результата, все узлы которого лежат в одном массиве без указателей: корень -- первый
+    элемент, потомки каждого узла занимают непрерывный диапазон индексов. Такое дерево можно
+    сохранить в файл или отобразить в память как есть.
+*/
+struct FlatTree {
+  /** Количество узлов в массиве nodes. */
+  unsigned int count;
+  /** Массив узлов в порядке обхода в ширину. */
+  struct FlatNode* nodes;
+};
+/** Блок памяти арены. Данные блока располагаются сразу за заголовком. */
+struct ArenaBlock {
+  /** Предыдущий блок арены. */
+  struct ArenaBlock* prev;
+  /** Смещение начала данных блока от начала арены. */
+  unsigned long base;
+  /** Размер области данных блока в байтах. */
+  unsigned long size;
+};
+/** Арена -- область памяти, из которой последовательно выделяются узлы результатов разбора.
+    Отдельные узлы не освобождаются: при неудаче разбора память откатывается к отметке, запомненной
+    перед ним, а все дерево освобождается разом вызовом destroyArena.
+*/
+struct Arena {
+  /** Последний блок арены, из которого выделяется память. */
+  struct ArenaBlock* top;
+  /** Блок, освободившийся при откате, сохраняемый для повторного использования. */
+  struct ArenaBlock* spare;
+  /** Количество занятых байт от начала арены. Является отметкой для отката. */
+  unsigned long used;
+  /** Отметка, раньше которой откатываться нельзя: там лежат результаты из таблицы мемоизации. */
+  unsigned long pin;
 };
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 /* Вспомогательные структуры. */
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 /** Тип функции для очистки пользовательских данных, когда структура результата разрушается. */
 typedef void (*FreeUserDataFunc)(const void*);
+/** Запись таблицы мемоизации: результат разбора правила, начатого в определенной позиции. */
+struct MemoEntry {
+  /** Номер правила в грамматике, увеличенный на 1. 0 означает, что запись свободна. */
+  unsigned int rule;
+  /** Смещение в разбираемых данных, с которого начинался разбор правила. */
+  unsigned int offset;
+  /** Результат разбора правила, в том числе FAILED. Таблица владеет одной ссылкой на него. */
+  struct Result* result;
+  /** Смещение позиции, на которой закончился разбор правила. */
+  unsigned int end;
+  /** Смещение за последним байтом, прочитанным при разборе правила, включая заглядывание
+      вперед. Отслеживается только инкрементальным разбором: запись остается верной, пока не
+      изменились данные от offset до examined.
+  */
+  unsigned int examined;
+  /** Наибольшее смещение, в котором при разборе правила была сообщена неудача, или 0. Отслеживается
+      только инкрементальным разбором: при повторном использовании записи неудача воспроизводится,
+      чтобы позиция ошибки не зависела от того, какие правила разобраны заново.
+  */
+  unsigned int failed;
+  /** Поколение таблицы, в котором сделана запись. Записи прошлых поколений считаются свободными. */
+  unsigned int epoch;
+};
+/** Таблица мемоизации результатов разбора правил (packrat). Таблица имеет фиксированный размер,
+    запись для новой пары (правило, позиция) вытесняет запись, занимавшую ту же ячейку.
+*/
+struct Memo {
+  /** Количество записей в таблице, всегда степень двойки. 0, если мемоизация не используется. */
+  unsigned int size;
+  /** Массив из @link size записей@endlink. */
+  struct MemoEntry* entries;
+  /** Текущее поколение таблицы. Увеличивается, когда все запомненные результаты устаревают. */
+  unsigned int epoch;
+  /** Количество результатов, запомненных в текущем поколении. По нему инкрементальный разбор
+      подбирает размер таблицы под документ.
+  */
+  unsigned int count;
+};
+/** Функция чтения очередной порции потока в буфер @a buffer размером @a size байт.
+    Возвращает количество прочитанных байт или 0, если поток закончился.
+*/
+typedef unsigned int (*ReadFunc)(void* source, char* buffer, unsigned int size);
+/** Функция обработки очередной записи потока. Узел @a record и данные, на которые он ссылается,
+    действительны только до возврата из функции. @a offset -- смещение начала записи от начала
+    потока. Ненулевой результат прекращает разбор.
+*/
+typedef int (*RecordFunc)(void* data, struct Result* record, unsigned long offset);
+enum E_STREAM_STATUS {
+  /** Поток закончился, все его данные разобраны. */
+  E_STREAM_OK,
+  /** Очередная запись не разобрана, подробности в @link Stream::failInfo failInfo@endlink. */
+  E_STREAM_FAILED,
+  /** Очередная запись не поместилась в буфер. */
+  E_STREAM_OVERFLOW,
+  /** Разбор прекращен функцией обработки записи. */
+  E_STREAM_STOPPED,
+  /** Правило для разбора записей не найдено. */
+  E_STREAM_NO_RULE
+};
+/** Функция обработки результата разбора @a index-го элемента пакета входных данных. Вызывается
+    одновременно из нескольких потоков. Результат и сессия @a session, в которой он получен
+    (у нее можно запросить sessionFailInfo), действительны только до возврата из функции.
+    Ненулевой результат прекращает разбор пакета.
+*/
+typedef int (*BatchFunc)(void* data, unsigned int index, struct Result* result, struct Session* session);
+enum E_BATCH_STATUS {
+  /** Все данные разобраны. */
+  E_BATCH_OK,
+  /** Данные разобраны не до конца: очередная запись не разобрана. */
+  E_BATCH_FAILED,
+  /** Разбор прекращен функцией обработки результата. */
+  E_BATCH_STOPPED,
+  /** Не хватило памяти для сессий разбора. */
+  E_BATCH_NO_MEMORY,
+  /** Стартовое правило не найдено. */
+  E_BATCH_NO_RULE
+};
+/** Потоковый источник разбираемых данных. Данные читаются в буфер фиксированного размера (окно),
+    из которого после разбора каждой записи удаляются ее байты, поэтому размер буфера ограничивает
+    только размер одной записи, но не всего потока.
+*/
+struct Stream {
+  /** Функция чтения данных. */
+  ReadFunc read;
+  /** Источник данных, передаваемый в функцию чтения. */
+  void* source;
+  /** Буфер окна. */
+  char* buffer;
+  /** Размер буфера окна в байтах. */
+  unsigned int size;
+  /** Смещение начала буфера от начала потока. После завершения разбора -- смещение первого
+      байта, не вошедшего ни в одну запись.
+  */
+  unsigned long base;
+  /** Ненулевое значение, если функция чтения сообщила о конце потока. */
+  int eof;
+  /** Ненулевое значение, если запись не поместилась в буфер. */
+  int overflow;
+  /** Информация об ошибке разбора записи. Позиция отсчитывается от @link base начала буфера@endlink.
+      Массив `expected` необходимо освободить функцией `free`.
+  */
+  struct FailInfo failInfo;
+};
+/** Счетчики профилирования одного правила грамматики. Заполняются, только если парсер
+    скомпилирован с макросом PEG_PROFILE.
+*/
+struct RuleProfile {
+  /** Количество вызовов функций разбора и проверки правила. */
+  unsigned long calls;
+  /** Количество успешных разборов правила. */
+  unsigned long successes;
+  /** Количество неудачных разборов правила. */
+  unsigned long failures;
+  /** Суммарное количество байт, разобранных правилом при успешных разборах. */
+  unsigned long consumed;
+  /** Суммарное количество байт, на которые откатывалась текущая позиция внутри правила. */
+  unsigned long backtracked;
+  /** Количество вызовов, результат которых взят из таблицы мемоизации. */
+  unsigned long memoHits;
+  /** Количество вызовов правила с мемоизацией, не нашедших результат в таблице. */
+  unsigned long memoMisses;
+  /** Время, проведенное в самом правиле без учета вложенных правил, в единицах счетчика
+      PEG_PROFILE_CLOCK. Если счетчик не задан, всегда 0.
+  */
+  unsigned long ticks;
+};
+/** Таблица счетчиков профилирования всех правил грамматики. Каждый разбор (и каждая сессия)
+    ведет счетчики в собственной таблице, а по окончании переносит их в общую таблицу парсера.
+*/
+struct Profile {
+  /** Количество правил в массивах names и rules. */
+  unsigned int count;
+  /** Имена правил, индекс совпадает с номером правила. */
+  const char* const* names;
+  /** Счетчики правил, индекс совпадает с номером правила. */
+  struct RuleProfile* rules;
+  /** Таблица, в которую переносятся счетчики функцией flushProfile, или `NULL` у общей таблицы. */
+  struct Profile* total;
+};
+struct ProfileFrame;
 struct Context {
   /** Разбираемые данные. */
   struct Range input;
-  /** Текущая позиция в разбираемых данных. */
-  struct Location current;
+  /** Смещение текущей позиции от начала разбираемых данных. Полные @link Location позиции@endlink
+      создаются только для результатов разбора и информации об ошибке.
+  */
+  unsigned int current;
   /** Информация об ошибках разбора. */
   struct FailInfo failInfo;
+  /** Ожидаемые элементы в позиции ошибки, из которых по запросу строится список failInfo.expected. */
+  struct ExpectedSet expected;
   /** Функция для удаления ассациированных с @link Result результатами разбора@endlink
       пользовательских данных. В нее может приходить `NULL`. Данная функция вызывается
       перед удалением потомков узла результата, так что она может получить к ним доступ.
@@ -103,17 +350,40 @@ struct Context {
   FreeUserDataFunc freeUserDataFunc;
   /** Информация, передаваемая пользователем в парсер. Парсером не используется. */
   void* userData;
+  /** Таблица мемоизации для правил, разбираемых с запоминанием результатов. */
+  struct Memo memo;
+  /** Арена, в которой выделяются результаты разбора, или `NULL`, если они выделяются в куче. */
+  struct Arena* arena;
+  /** Поток, из которого дочитываются данные, или `NULL`, если данные переданы целиком. */
+  struct Stream* stream;
+  /** Смещение за последним байтом, прочитанным разбором. Отслеживается только инкрементальным
+      разбором, для которого определяется макрос PEG_INCREMENTAL.
+  */
+  unsigned int examined;
+  /** Наибольшее смещение, в котором разбор сообщил неудачу. Отслеживается только инкрементальным
+      разбором, для которого определяется макрос PEG_INCREMENTAL.
+  */
+  unsigned int failed;
+#ifdef PEG_PROFILE
+  /** Таблица, в которую записываются счетчики профилирования, или `NULL`, если они не нужны. */
+  struct Profile* profile;
+  /** Кадр профилирования правила, разбираемого в данный момент. */
+  struct ProfileFrame* frame;
+#endif
 };
 
 /** Константа, возвращаемая из функций разбора в том случае, если разбор был неуспешен.
     Соответствие результата разбора данной константе может быть проверено макросом isFailed.
+    Как и NIL, никогда не изменяется (все функции, меняющие узлы, проверяют это явно), поэтому
+    одновременные разборы в разных потоках могут возвращать ее без синхронизации. Пользовательский
+    код также не должен ее изменять.
 */
-static struct Result FAILED = {{{0, 0, 0, 0}, {0, 0, 0, 0}}, 0, 0, 0};
+static struct Result FAILED = {{{0, 0, 0, 0}, {0, 0, 0, 0}}, 0, 0, 0, 0, 0};
 /** Константа, используемая как результат успешного разбора для предикатов
     и опциональных элементов, когда опциональное значение отсутствует.
     Соответствие результата разбора данной константе может быть проверено макросом isNil.
 */
-static struct Result NIL    = {{{0, 0, 0, 0}, {0, 0, 0, 0}}, 0, 0, 0};
+static struct Result NIL    = {{{0, 0, 0, 0}, {0, 0, 0, 0}}, 0, 0, 0, 0, 0};
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 /* Работа с памятью. */
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
@@ -122,6 +392,14 @@ void freeResult(/*struct Context* context, */struct Result* result) {
     return;
   }
   if (result) {
+    /* Узел принадлежит арене и будет освобожден вместе с ней. */
+    if (result->refs == 0) {
+      return;
+    }
+    /* Узел еще используется где-то еще (например, в таблице мемоизации). */
+    if (--result->refs > 0) {
+      return;
+    }
     /* Чистим пользовательские данные. */
     /*if (context->freeUserDataFunc) {
       (*context->freeUserDataFunc)(result->userData);
@@ -142,3 +420,37 @@ void freeResult(/*struct Context* context, */struct Result* result) {
     free(result);
   }
 }
+/** Создает пустую арену. Память под блоки выделяется по мере необходимости.
+
+@return Новую арену или `NULL`, если не хватило памяти. Арену необходимо уничтожить функцией
+        destroyArena, когда результаты разбора, выделенные в ней, больше не будут нужны.
+*/
+struct Arena* createArena(void) {
+  return (struct Arena*)calloc(1, sizeof(struct Arena));
+}
+/** Освобождает все результаты разбора, выделенные в арене, оставляя саму арену пригодной для
+    следующего разбора. Один блок памяти сохраняется для повторного использования.
+*/
+void resetArena(struct Arena* arena) {
+  assert(arena);
+  while (arena->top) {
+    struct ArenaBlock* prev = arena->top->prev;
+    if (arena->spare == 0 || arena->spare->size < arena->top->size) {
+      free(arena->spare);
+      arena->spare = arena->top;
+    } else {
+      free(arena->top);
+    }
+    arena->top = prev;
+  }
+  arena->used = 0;
+  arena->pin  = 0;
+}
+/** Освобождает арену вместе со всеми выделенными в ней результатами разбора. */
+void destroyArena(struct Arena* arena) {
+  if (arena) {
+    resetArena(arena);
+    free(arena->spare);
+    free(arena);
+  }
+}
@@ -0,0 +1,223 @@
+/// Вспомогательные функции для проходов, оптимизирующих AST грамматики перед генерацией кода.
+var asts = require("pegjs/lib/compiler/asts");
+
+/// Типы узлов, результат разбора которых отбрасывается. Внутри них форма дерева результата
+/// не видна ни пользователю, ни действиям, поэтому ее можно менять.
+var UNOBSERVED = { text: true, simple_and: true, simple_not: true };
+
+/// Создает глубокую копию выражения.
+function clone(node) {
+  if (node instanceof Array) {
+    return node.map(clone);
+  }
+  if (node === null || typeof node !== 'object') {
+    return node;
+  }
+  var copy = {};
+  for (var k in node) if (node.hasOwnProperty(k)) {
+    // Позиция в исходном тексте грамматики общая для всех копий.
+    copy[k] = k === 'region' || k === 'location' ? node[k] : clone(node[k]);
+  }
+  return copy;
+}
+/// Обходит все выражения грамматики снизу вверх и заменяет каждый узел результатом функции @a f.
+/// @f Функция `(node, unobserved)`, возвращающая узел, которым нужно заменить @a node. Флаг
+///    `unobserved` истинен, если результат разбора узла отбрасывается (узел находится внутри `$`,
+///    `&` или `!`), так что форму его дерева менять можно.
+function transform(ast, f) {
+  function walk(node, unobserved) {
+    var inner = unobserved || UNOBSERVED.hasOwnProperty(node.type);
+    if (node.expression) {
+      node.expression = walk(node.expression, inner);
+    }
+    if (node.elements) {
+      node.elements = node.elements.map(function(n) { return walk(n, inner); });
+    }
+    if (node.alternatives) {
+      node.alternatives = node.alternatives.map(function(n) { return walk(n, inner); });
+    }
+    var result = f(node, unobserved);
+    // Замененный узел подставленного правила по-прежнему должен получить номер этого правила.
+    if (result !== node && node.inlinedRule !== undefined && result.inlinedRule === undefined) {
+      result.inlinedRule = node.inlinedRule;
+    }
+    return result;
+  }
+  ast.rules.forEach(function(rule) {
+    rule.expression = walk(rule.expression, false);
+  });
+}
+/// Возвращает количество узлов в выражении.
+function size(node) {
+  return 1 + (node.expression ? size(node.expression) : 0)
+    + (node.elements || node.alternatives || []).reduce(function(s, n) { return s + size(n); }, 0);
+}
+/// Определяет, содержит ли выражение узел, для которого функция @a f возвращает `true`.
+function contains(node, f) {
+  return f(node)
+    || (node.expression ? contains(node.expression, f) : false)
+    || (node.elements || node.alternatives || []).some(function(n) { return contains(n, f); });
+}
+/// Возвращает множество байтов, с которыми сопоставляется класс символов или литерал из одного
+/// символа, в виде массива из 256 логических значений, или `null`, если узел сопоставляется не
+/// с одним байтом либо использует возможности, не поддерживаемые генератором (регистронезависимое
+/// сравнение, символы вне диапазона 0-255). Такие узлы оптимизации оставляют как есть.
+function bytesOf(node) {
+  var bytes = [], ch;
+  if (node.ignoreCase) {
+    return null;
+  }
+  if (node.type === 'literal') {
+    if (node.value.length !== 1 || node.value.charCodeAt(0) > 0xFF) {
+      return null;
+    }
+    for (ch = 0; ch < 256; ++ch) {
+      bytes.push(ch === node.value.charCodeAt(0));
+    }
+    return bytes;
+  }
+  if (node.type !== 'class') {
+    return null;
+  }
+  var ranges = node.parts.map(function(p) {
+    return [(p instanceof Array ? p[0] : p).charCodeAt(0), (p instanceof Array ? p[1] : p).charCodeAt(0)];
+  });
+  if (ranges.some(function(r) { return r[1] > 0xFF; })) {
+    return null;
+  }
+  for (ch = 0; ch < 256; ++ch) {
+    bytes.push(node.inverted !== ranges.some(function(r) { return r[0] <= ch && ch <= r[1]; }));
+  }
+  return bytes;
+}
+/// Создает класс символов, сопоставляющийся с байтами из множества @a bytes (в формате bytesOf).
+/// @region Позиция в тексте грамматики, к которой будут относиться сообщения о новом узле.
+function classOf(bytes, region) {
+  function escape(ch) {
+    var c = ch.charCodeAt(0);
+    if (/[\\\]\^\-]/.test(ch)) { return '\\' + ch; }
+    if (c < 0x20 || c > 0x7E) { return '\\x' + (c < 16 ? '0' : '') + c.toString(16).toUpperCase(); }
+    return ch;
+  }
+  var parts = [];
+  for (var from = 0; from < 256; ++from) {
+    if (!bytes[from]) {
+      continue;
+    }
+    var to = from;
+    while (to < 255 && bytes[to + 1]) {
+      ++to;
+    }
+    parts.push(from === to ? String.fromCharCode(from) : [String.fromCharCode(from), String.fromCharCode(to)]);
+    from = to;
+  }
+  return {
+    type:       'class',
+    parts:      parts,
+    inverted:   false,
+    ignoreCase: false,
+    rawText:    '[' + parts.map(function(p) {
+      return p instanceof Array ? escape(p[0]) + '-' + escape(p[1]) : escape(p);
+    }).join('') + ']',
+    region:     region,
+  };
+}
+/// Определяет, завершается ли разбор выражения успешно при любых входных данных.
+/// @visiting Имена правил, анализируемых в данный момент. Рекурсивные ссылки считаются способными
+///           завершиться неудачей, что всегда безопасно.
+function alwaysMatches(ast, node, visiting) {
+  visiting = visiting || [];
+  switch (node.type) {
+    case 'literal':      return node.value.length === 0;
+    case 'optional':
+    case 'zero_or_more': return true;
+    case 'range':        return !node.min || alwaysMatches(ast, node.expression, visiting);
+    case 'sequence':     return node.elements.every(function(n) { return alwaysMatches(ast, n, visiting); });
+    case 'choice':       return node.alternatives.some(function(n) { return alwaysMatches(ast, n, visiting); });
+    case 'named':
+    case 'action':
+    case 'labeled':
+    case 'text':
+    case 'one_or_more':
+    case 'simple_and':   return alwaysMatches(ast, node.expression, visiting);
+    case 'simple_not':   return neverMatches(ast, node.expression, visiting);
+    case 'rule_ref':     return followRef(ast, node, visiting, alwaysMatches);
+    default:             return false;
+  }
+}
+/// Определяет, завершается ли разбор выражения неудачей при любых входных данных.
+function neverMatches(ast, node, visiting) {
+  visiting = visiting || [];
+  switch (node.type) {
+    case 'class':        var bytes = bytesOf(node); return bytes !== null && bytes.indexOf(true) < 0;
+    case 'range':        return node.min > 0 && neverMatches(ast, node.expression, visiting);
+    case 'sequence':     return node.elements.some(function(n) { return neverMatches(ast, n, visiting); });
+    case 'choice':       return node.alternatives.every(function(n) { return neverMatches(ast, n, visiting); });
+    case 'named':
+    case 'action':
+    case 'labeled':
+    case 'text':
+    case 'one_or_more':
+    case 'simple_and':   return neverMatches(ast, node.expression, visiting);
+    case 'simple_not':   return alwaysMatches(ast, node.expression, visiting);
+    case 'rule_ref':     return followRef(ast, node, visiting, neverMatches);
+    default:             return false;
+  }
+}
+function followRef(ast, node, visiting, f) {
+  var rule = asts.findRule(ast, node.name);
+  if (!rule || visiting.indexOf(node.name) >= 0) {
+    return false;
+  }
+  return f(ast, rule.expression, visiting.concat([node.name]));
+}
+/// Определяет, нужно ли запоминать результаты разбора правила (packrat). Запоминание включается
+/// для всех правил опцией `memoize: true` и инкрементальным разбором, который повторно использует
+/// результаты всех правил, для перечисленных правил -- опцией `memoize: [имена]`, а также
+/// аннотацией `@memoize` у правила, если используемая версия pegjs поддерживает аннотации.
+function isMemoized(rule, options) {
+  var memoize = options.memoize;
+  if (memoize === true || options.incremental) { return true; }
+  if (memoize instanceof Array && memoize.indexOf(rule.name) >= 0) { return true; }
+  return (rule.annotations || []).some(function(a) { return a.name === 'memoize'; });
+}
+/// Определяет, содержит ли выражение пользовательский код (действия или семантические предикаты),
+/// в том числе в правилах, на которые оно ссылается.
+/// @visited Имена уже просмотренных правил.
+function hasUserCode(ast, node, visited) {
+  visited = visited || [];
+  return contains(node, function(n) {
+    if (n.type === 'action' || n.type === 'semantic_and' || n.type === 'semantic_not') {
+      return true;
+    }
+    if (n.type !== 'rule_ref' || visited.indexOf(n.name) >= 0) {
+      return false;
+    }
+    visited.push(n.name);
+    var rule = asts.findRule(ast, n.name);
+    return rule ? hasUserCode(ast, rule.expression, visited) : false;
+  });
+}
+/// Возвращает ссылку на правило записей, если стартовое правило грамматики -- повторение другого
+/// правила (`start = record*` или `start = record+`), иначе `null`. Потоковый разбор фиксируется
+/// после каждой записи, а параллельный делит данные по записям, поэтому оптимизации не должны
+/// заменять эту ссылку.
+function recordRef(ast) {
+  var start = ast.rules.length > 0 ? ast.rules[0].expression : null;
+  return start && (start.type === 'zero_or_more' || start.type === 'one_or_more')
+    && start.expression.type === 'rule_ref' ? start.expression : null;
+}
+
+module.exports = {
+  clone:         clone,
+  transform:     transform,
+  size:          size,
+  contains:      contains,
+  bytesOf:       bytesOf,
+  classOf:       classOf,
+  alwaysMatches: alwaysMatches,
+  neverMatches:  neverMatches,
+  hasUserCode:   hasUserCode,
+  isMemoized:    isMemoized,
+  recordRef:     recordRef,
+};
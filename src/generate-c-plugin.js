@@ -1,5 +1,21 @@
+/// Оптимизации AST в порядке их выполнения. Они меняют сообщения об ошибках, поэтому по умолчанию
+/// выключены: все сразу включаются опцией `optimize: true`, а опция `optimize: { <имя>: false }`
+/// включает все, кроме перечисленных.
+var optimizations = [
+  ['inlineRules',            require('./passes/inline-rules')],
+  ['concatLiterals',         require('./passes/concat-literals')],
+  ['removeDeadAlternatives', require('./passes/remove-dead-alternatives')],
+  ['factorPrefixes',         require('./passes/factor-prefixes')],
+  ['mergeClasses',           require('./passes/merge-classes')],
+];
+
 module.exports.use = function(config, options) {
-  config.passes.generate = [
+  var optimize = options && options.optimize ? options.optimize : false;
+  config.passes.generate = optimizations.filter(function(o) {
+    return optimize === true || (optimize !== false && optimize[o[0]] !== false);
+  }).map(function(o) {
+    return o[1];
+  }).concat([
     require('./passes/generate'),
-  ];
-};
\ No newline at end of file
+  ]);
+};
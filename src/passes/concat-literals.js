@@ -0,0 +1,37 @@
+var utils = require("../ast-utils");
+
+/// Объединяет соседние литералы последовательностей в один литерал (`"a" "b"` -> `"ab"`), чтобы
+/// они сравнивались одним вызовом. Так как количество элементов последовательности при этом
+/// меняется, объединяются только литералы, результат разбора которых отбрасывается (внутри `$`,
+/// `&` и `!`).
+function concatLiterals(ast) {
+  function isPlain(node) {
+    return node.type === 'literal' && !node.ignoreCase;
+  }
+  utils.transform(ast, function(node, unobserved) {
+    if (node.type !== 'sequence' || !unobserved) {
+      return node;
+    }
+    var elements = [];
+    node.elements.forEach(function(e) {
+      var last = elements[elements.length - 1];
+      if (last && isPlain(last) && isPlain(e)) {
+        elements[elements.length - 1] = {
+          type:       'literal',
+          value:      last.value + e.value,
+          ignoreCase: false,
+          region:     last.region,
+        };
+      } else {
+        elements.push(e);
+      }
+    });
+    if (elements.length === 1) {
+      return elements[0];
+    }
+    node.elements = elements;
+    return node;
+  });
+}
+
+module.exports = concatLiterals;
@@ -0,0 +1,63 @@
+var utils = require("../ast-utils");
+
+/// Выносит общий префикс идущих подряд литералов-альтернатив выбора (`"abc" / "abd"` ->
+/// `"ab" ("c" / "d")`), чтобы он сравнивался один раз. Так как результат разбора выбора при этом
+/// становится последовательностью, префиксы выносятся только там, где результат отбрасывается
+/// (внутри `$`, `&` и `!`).
+function factorPrefixes(ast) {
+  function isPlain(node) {
+    return node.type === 'literal' && !node.ignoreCase && node.value.length > 0;
+  }
+  function literal(value, region) {
+    return { type: 'literal', value: value, ignoreCase: false, region: region };
+  }
+  /// Возвращает длину общего префикса строк.
+  function commonPrefix(values) {
+    var len = 0;
+    while (values.every(function(v) { return len < v.length && v.charAt(len) === values[0].charAt(len); })) {
+      ++len;
+    }
+    return len;
+  }
+  function factor(node) {
+    var alternatives = [];
+    for (var i = 0; i < node.alternatives.length; ++i) {
+      var a = node.alternatives[i];
+      var j = i + 1;
+      if (isPlain(a)) {
+        while (j < node.alternatives.length && isPlain(node.alternatives[j])
+            && node.alternatives[j].value.charAt(0) === a.value.charAt(0)) {
+          ++j;
+        }
+      }
+      if (j - i < 2) {
+        alternatives.push(a);
+        continue;
+      }
+      var group = node.alternatives.slice(i, j);
+      var len = commonPrefix(group.map(function(n) { return n.value; }));
+      // Остатки литералов сами могут иметь общие префиксы.
+      var rest = factor({
+        type: 'choice',
+        alternatives: group.map(function(n) { return literal(n.value.substr(len), n.region); }),
+        region: a.region,
+      });
+      alternatives.push({
+        type: 'sequence',
+        elements: [literal(a.value.substr(0, len), a.region), rest],
+        region: a.region,
+      });
+      i = j - 1;
+    }
+    if (alternatives.length === 1) {
+      return alternatives[0];
+    }
+    node.alternatives = alternatives;
+    return node;
+  }
+  utils.transform(ast, function(node, unobserved) {
+    return node.type === 'choice' && unobserved ? factor(node) : node;
+  });
+}
+
+module.exports = factorPrefixes;
@@ -2,6 +2,7 @@ var arrays  = require("pegjs/lib/utils/arrays"),
     objects = require("pegjs/lib/utils/objects"),
     asts    = require("pegjs/lib/compiler/asts"),
     visitor = require("pegjs/lib/compiler/visitor"),
+    utils   = require("../ast-utils"),
     GrammarError = require("pegjs/lib/grammar-error");
 
 function generateCCode(ast, options) {
@@ -242,69 +243,127 @@ function generateCCode(ast, options) {
       }
     };
   }
-  function makeContext(code) {
+  /// Узлы результата размещаются в арене не только в `parseArena`, но и в `parseFlat` и в сессиях
+  /// (в том числе параллельного и инкрементального разбора), и во всех этих случаях память
+  /// неудачных разборов должна возвращаться в арену откатом к отметке.
+  var useArena = options.arena || options.flat || options.session || options.threads || options.incremental;
+  /// @keepLabels Если `true`, помеченные элементы последовательностей строятся и в режиме пропуска,
+  ///             так как их значения могут понадобиться пользовательскому коду.
+  function makeContext(code, keepLabels) {
     var resultStack = makeStack('r', 'ResultPtr');
-    var posStack    = makeStack('p', 'struct Location');
+    // Позиции запоминаются только смещениями, полные Location создаются лишь для результатов.
+    var posStack    = makeStack('p', 'unsigned int');
+    // Отметки арены запоминаются и восстанавливаются вместе с позициями. Исключения -- начальная
+    // позиция правила с мемоизацией, нужная только для запоминания результата, и отметки без
+    // позиций (pushMark), нужные только для отката арены.
+    var markStack   = makeStack('m', 'unsigned long');
+    // Счетчики повторений в режиме пропуска, где вместо массива результатов считаются только элементы.
+    var countStack  = makeStack('k', 'unsigned int');
 
     var builder = new CodeBuilder(code);
 
-    function pushPos() {
+    /// @noMark Если `true`, отметка арены вместе с позицией не запоминается.
+    function pushPos(noMark) {
       // Эта функция сгенерирует некорректный код для C, поэтому ничего в нее
       // не передаем. Нам важно только то, что сейчас увеличится указатель стека.
       posStack.push();
-      return 'memcpy(&' + posStack.top() + ', &ctx->current, sizeof(struct Location));';
+      var code = posStack.top() + ' = ctx->current;';
+      if (useArena && !noMark) {
+        code += ' ' + markStack.push('markArena(ctx)');
+      }
+      return code;
+    }
+    /// Генерирует код отката арены к отметке, запомненной вместе с последней позицией.
+    function rewind() {
+      return useArena ? 'rewindArena(ctx, ' + markStack.top() + ');' : '';
+    }
+    /// Генерирует код восстановления последней запомненной позиции, не снимая ее со стека.
+    function restorePos() {
+      var code = 'PEG_BACKTRACK(ctx, ' + posStack.top() + '); ctx->current = ' + posStack.top() + ';';
+      return useArena ? code + ' ' + rewind() : code;
     }
     function popPos() {
-      return 'memcpy(&ctx->current, &' + posStack.pop() + ', sizeof(struct Location));';
+      var code = restorePos();
+      dropPos();
+      return code;
+    }
+    /// Снимает последнюю запомненную позицию со стека без генерации кода.
+    /// @noMark Должен совпадать с аргументом pushPos, запомнившего позицию.
+    /// @return Имя переменной, в которой хранилась позиция.
+    function dropPos(noMark) {
+      if (useArena && !noMark) {
+        markStack.pop();
+      }
+      return posStack.pop();
+    }
+    /// Генерирует код запоминания отметки арены без позиции.
+    function pushMark() {
+      return markStack.push('markArena(ctx)');
+    }
+    /// Снимает последнюю отметку арены, запомненную pushMark.
+    function dropMark() {
+      return markStack.pop();
     }
 
-    function make(sp, env, action) {
+    /// @skip Если `true`, выражение только проверяется: вместо узлов результата возвращается `&NIL`.
+    function make(sp, env, action, skip) {
       return {
         sp:     sp,    ///< Номер первой переменной для этого контекста.
         env:    env,   // mapping of label names to stack positions
         action: action,// action nodes pass themselves to children here
+        skip:   skip,  ///< Генерировать ли код разбора без построения результата.
+        keepLabels: keepLabels,
 
         resultStack: resultStack,
         posStack: posStack,
+        markStack: markStack,
+        countStack: countStack,
 
         pushCode: builder.push,
         indent: builder.indent,
         dedent: builder.dedent,
 
-        child: make,
+        /// Создает контекст для дочернего выражения. Если режим пропуска не указан, он наследуется.
+        child: function(sp, env, action, skip) {
+          return make(sp, env, action, skip === undefined ? this.skip : skip);
+        },
 
         pushPos: pushPos,
         popPos:  popPos,
+        dropPos: dropPos,
+        pushMark: pushMark,
+        dropMark: dropMark,
+        restorePos: restorePos,
+        rewind:  rewind,
       };
     }
-    return make(-1, {}, null);
+    return make(-1, {}, null, false);
   }
 
   function generateSimplePredicate(expression, negative, context) {
     context.pushCode(
       context.pushPos(),
-      '++ctx->failInfo.silent'
+      '++ctx->failInfo.silent;'
     );
-    generate(expression, context.child(context.sp + 1, objects.clone(context.env), null));
+    // Результат выражения внутри предиката не нужен, поэтому оно только проверяется.
+    generate(expression, context.child(context.sp, objects.clone(context.env), null, true));
     var r = context.resultStack.pop();
     var f = context.resultStack.push('&FAILED');
     var p = context.popPos();
     context.pushCode(
-      '--ctx->failInfo.silent',
+      '--ctx->failInfo.silent;',
       'if (' + (negative ? '' : '!') + 'isFailed(' + r + ')) {'
     );
     if (negative) {
       context.pushCode(
         '  ' + r + ' = &NIL;',
         '} else {',
-        '  freeResult(' + r + ');',
         '  ' + p,
         '  ' + f,
         '}'
       );
     } else {
       context.pushCode(
-        '  freeResult(' + r + ');',
         '  ' + p,
         '  ' + r + ' = &NIL;',
         '} else {',
@@ -327,6 +386,15 @@ function generateCCode(ast, options) {
     );
   }
   function generateRange(expression, context, min, max) {
+    // Повторение класса символов разбирается одним вызовом, пропускающим подходящие байты блоками.
+    // Подставленному правилу нужен номер у результата каждого байта, поэтому для него это
+    // возможно только без построения результата.
+    if (expression.type === 'class' && (context.skip || expression.inlinedRule === undefined)) {
+      context.pushCode(context.resultStack.push(
+        (context.skip ? 'skipCharClassRun' : 'parseCharClassRun') + '(ctx, &' + classConstant(expression) + ', &' + classExpected(expression) + ', ' + (min || 0) + ', ' + (max || 0) + ')'
+      ));
+      return;
+    }
     // Если задан минимум, то может понадобится откатится в начало правила, поэтому
     // запоминаем текущую позицию. Однако, если минимум равен 0, то фактически его нет
     // поэтому в этом случае никакого запоминания не требуется.
@@ -334,32 +402,59 @@ function generateCCode(ast, options) {
     if (hasMin) {
       context.pushCode(context.pushPos());
     }
-    context.pushCode(context.resultStack.push('createArray()'));
+    // В режиме пропуска элементы не собираются в массив, а только подсчитываются.
+    var count;
+    if (context.skip) {
+      context.pushCode(context.countStack.push('0'));
+      count = context.countStack.top();
+      context.pushCode(context.resultStack.push('&NIL'));
+    } else {
+      context.pushCode(context.resultStack.push('createArray(ctx)'));
+      count = context.resultStack.top() + '->count';
+    }
     var arr = context.resultStack.top();
     context.indent('do {');
     // Если задан максимум, генерируем проверку максимума
     if (max) {
-      context.pushCode('if (' + arr + '->count >= ' + max + ') { break; }');
+      context.pushCode('if (' + count + ' >= ' + max + ') { break; }');
     }
     generate(expression, context.child(context.sp + 1, objects.clone(context.env), null));
     context.pushCode('if (isFailed(' + context.resultStack.top() + ')) { break; }');
-    context.pushCode('append(' + arr + ', ' + context.resultStack.pop() + ');');
+    if (context.skip) {
+      context.resultStack.pop();
+      context.pushCode('++' + count + ';');
+    } else {
+      context.pushCode('append(ctx, ' + arr + ', ' + context.resultStack.pop() + ');');
+    }
     context.dedent('} while (1);');
     // Если задан максимум, генерируем проверку минимума
     if (hasMin) {
       context.resultStack.pop();
+      context.pushCode('if (' + count + ' < ' + min + ') {');
+      context.pushCode('  ' + context.popPos());
+      if (!context.skip) {
+        context.pushCode('  freeResult(' + arr + ');');
+      }
       context.pushCode(
-        'if (' + arr + '->count < ' + min + ') {',
-        '  ' + context.popPos(),
-        '  freeResult(' + arr + ');',
         '  ' + context.resultStack.push('&FAILED'),
         '}'
       );
     }
+    if (context.skip) {
+      context.countStack.pop();
+    }
+  }
+  /// Определяет, есть ли в выражении пользовательский код (действия или семантические предикаты).
+  function hasUserCode(node) {
+    var found = false;
+    function mark() { found = true; }
+    visitor.build({ action: mark, semantic_and: mark, semantic_not: mark })(node);
+    return found;
   }
   /// Возвращает имя функции, разбирающей правило с указанным именем.
-  function r(name) { return '_parse' + name; }
-  function rDef(node) { return 'INTERNAL static struct Result* ' + r(node.name) + '(struct Context* ctx)'; }
+  /// @skip Если `true`, возвращается имя функции, проверяющей правило без построения результата.
+  function r(name, skip) { return (skip ? '_skip' : '_parse') + name; }
+  function rDef(node, skip) { return 'INTERNAL static struct Result* ' + r(node.name, skip) + '(struct Context* ctx)'; }
   function hex(ch) { return ch.charCodeAt(0).toString(16).toUpperCase(); }
   function escape(s) {
     return s
@@ -376,93 +471,546 @@ function generateCCode(ast, options) {
       .replace(/[\x10-\x1F\x80-\xFF]/g, function(ch) { return '\\x'  + hex(ch); });
   }
 
-  function createLookupTable(ruleNames) {
+  /// Строит битовую карту принадлежности байтов классу символов.
+  /// @parts Части класса: одиночные символы и массивы из двух символов -- границ диапазона.
+  /// @inverted Если `true`, карта строится для дополнения класса.
+  /// @return Массив из 32 чисел: байт `ch` входит в класс, если в элементе `ch >> 3` установлен
+  ///         бит `ch & 7`.
+  function classBits(parts, inverted) {
+    var bits = arrays.map(arrays.range(0, 32), function() { return 0; });
+    parts.forEach(function(p) {
+      var from = (p instanceof Array ? p[0] : p).charCodeAt(0);
+      var to   = (p instanceof Array ? p[1] : p).charCodeAt(0);
+      for (var ch = from; ch <= to && ch < 256; ++ch) {
+        bits[ch >> 3] |= 1 << (ch & 7);
+      }
+    });
+    return inverted ? bits.map(function(b) { return ~b & 0xFF; }) : bits;
+  }
+  function hexByte(b) { return '0x' + (b < 16 ? '0' : '') + b.toString(16).toUpperCase(); }
+  function createLookupTable(ruleNames, skip) {
     var entries = ruleNames.sort().map(function(n) {
-      return '  { ' + n.length + ', "' + n + '", &' + r(n) + ' }';
+      return '  { ' + n.length + ', "' + n + '", &' + r(n, skip) + ' }';
     });
     return [
-      'static struct ParseFunc funcs[] = {',
+      'static const struct ParseFunc ' + (skip ? 'skipFuncs' : 'funcs') + '[] = {',
       entries.join(',\n'),
       '};',
     ];
   }
 
-  var literals    = makeConstantBuilder('l', 'static struct Literal', function(v) {
+  var literals    = makeConstantBuilder('l', 'static const struct Literal', function(v) {
     return '{ ' + v.length + ', "' + escape(v) + '" }';
   });
-  var charClasses = makeConstantBuilder('c', 'static struct CharClass', function(parts) {
-    var single = parts.filter(function(p){return !(p instanceof Array);}).join('');
-    var ranges = parts.filter(function(p){return (p instanceof Array);}).map(function(p) { return p.join(''); });
+  var charClasses = makeConstantBuilder('c', 'static const struct CharClass', function(bits) {
+    // Границы подряд идущих байтов класса для векторного пропуска.
+    var ranges = [];
+    for (var ch = 0; ch < 256; ++ch) {
+      if (bits[ch >> 3] & (1 << (ch & 7))) {
+        var last = ranges[ranges.length - 1];
+        if (last && last[1] === ch - 1) {
+          last[1] = ch;
+        } else {
+          ranges.push([ch, ch]);
+        }
+      }
+    }
+    // Векторный код проверяет каждый диапазон отдельно, поэтому для классов из большого числа
+    // диапазонов (больше CLASS_RANGES из peg-internal.h) выгоднее побайтная проверка по карте.
+    if (ranges.length > 4) {
+      ranges = [];
+    }
+    var flat = [].concat.apply([], ranges);
 
     return [
       '{',
-      '  MAKE_LENGTHS(' + single.length + ', ' + ranges.length + '),',
-      '  "' + single + '",',
-      '  "' + ranges.join('') + '"',
+      '  { ' + bits.map(hexByte).join(', ') + ' },',
+      '  ' + ranges.length + ', { ' + (flat.length > 0 ? flat.map(hexByte).join(', ') : '0') + ' }',
       '}',
     ].join('\n');
   });
-  var expected    = makeConstantBuilder('e', 'static struct Expected', function(type, value, description) {
-    return '{ MAKE_TYPEANDLEN(E_EX_TYPE_' + type + ', ' + description.length + '), "' + escape(description) + '" }';
+  /// Описания ожидаемых элементов в порядке их номеров. Номер 0 занят ANY_EXPECTED из peg-internal.h,
+  /// поэтому номер элемента на 1 больше его индекса в массиве.
+  var expectedIds = [];
+  var expected    = makeConstantBuilder('e', 'static const struct Expected', function(type, value, description) {
+    var v = 'MAKE_TYPEANDLEN(E_EX_TYPE_' + type + ', ' + description.length + '), "' + escape(description) + '"';
+    var id = expectedIds.indexOf(v);
+    if (id < 0) {
+      id = expectedIds.push(v) - 1;
+    }
+    return '{ ' + v + ', ' + (id + 1) + ' }';
   });
 
   var ucb = makeUserCodeBuilder();
+  /// Таблицы выбора альтернатив по первому байту, в порядке их создания.
+  var dispatches = [];
+  /// Имена правил, для которых нужны функции проверки без построения результата.
+  var skipped = [];
+  /// Возвращает имя функции проверки правила, запоминая, что ее нужно сгенерировать.
+  function requireSkip(name) {
+    if (skipped.indexOf(name) < 0) {
+      skipped.push(name);
+    }
+    return r(name, true);
+  }
 
-  var generate = visitor.build({
+  /// Возвращает имя константы с битовой картой класса символов.
+  function classConstant(node) {
+    if (node.ignoreCase) {
+      emitWarning("Case insensitive matching not supported", node.rawText, node.region);
+    }
+    if (node.parts.some(function(p) { return /[^\x00-\xFF]/.test(p instanceof Array ? p.join('') : p); })) {
+      emitWarning("Unicode symbols not supported", node.rawText, node.region);
+    }
+    return charClasses.add(classBits(node.parts, node.inverted));
+  }
+  /// Возвращает имя константы с описанием ожидаемого класса символов.
+  function classExpected(node) {
+    return expected.add('CLASS', node.rawText, node.rawText);
+  }
+  /// Возвращает имя константы с описанием ожидаемого литерала.
+  function literalExpected(node) {
+    return expected.add(
+      'LITERAL',
+      node.ignoreCase ? node.value.toLowerCase() : node.value,
+      '"' + escape(node.value) + '"'
+    );
+  }
+  /// Возвращает имя константы с описанием ожидаемого именованного правила.
+  function namedExpected(node) {
+    return expected.add('USER', null, node.name);
+  }
+
+  function noBits()  { return arrays.map(arrays.range(0, 32), function() { return 0;    }); }
+  function allBits() { return arrays.map(arrays.range(0, 32), function() { return 0xFF; }); }
+  function orBits(a, b) { return a.map(function(v, i) { return v | b[i]; }); }
+  /// Результат анализа выражения, о котором ничего нельзя сказать заранее.
+  function inexact() { return { bits: allBits(), nullable: true, expected: [], exact: false }; }
+  /// Объединяет результаты анализа альтернатив выражения.
+  function orFirst(a, b) {
+    return {
+      bits:     orBits(a.bits, b.bits),
+      nullable: a.nullable || b.nullable,
+      expected: a.expected.concat(b.expected),
+      exact:    a.exact && b.exact,
+    };
+  }
+  /// Результаты анализа правил по их именам. На время анализа правила в нем хранится неточный
+  /// результат, так что рекурсия через необязательный префикс просто отключает оптимизацию.
+  var firstOfRules = {};
+  /// Анализирует, с каких байтов может начинаться успешный разбор выражения. Возвращает объект:
+  /// - `bits`: битовая карта (в формате classBits) байтов, с которых может начаться разбор;
+  /// - `nullable`: может ли выражение завершиться успешно, не поглотив ни одного байта;
+  /// - `expected`: имена констант ожидаемых элементов, о которых выражение сообщит, если текущий
+  ///   байт не входит в `bits` или достигнут конец данных. В этом случае выражение ничего не
+  ///   поглощает и завершается успешно, только если оно `nullable`;
+  /// - `exact`: выполняются ли все сказанное выше. Неточный результат получают выражения
+  ///   с пользовательским кодом, `.` и рекурсивные правила.
+  var first = visitor.build({
+    rule: function(node) {
+      if (!firstOfRules.hasOwnProperty(node.name)) {
+        firstOfRules[node.name] = inexact();
+        firstOfRules[node.name] = first(node.expression);
+      }
+      return firstOfRules[node.name];
+    },
+    named: function(node) {
+      var r = first(node.expression);
+      // Выражение внутри разбирается молча, о неудаче сообщается только имя правила.
+      return { bits: r.bits, nullable: r.nullable, expected: [namedExpected(node)], exact: r.exact };
+    },
+    choice: function(node) {
+      var r = { bits: noBits(), nullable: false, expected: [], exact: true };
+      node.alternatives.forEach(function(n) {
+        // После первой альтернативы, завершившейся успешно, остальные не разбираются.
+        var a = first(n);
+        r = r.nullable ? { bits: orBits(r.bits, a.bits), nullable: true, expected: r.expected, exact: r.exact && a.exact } : orFirst(r, a);
+      });
+      return r;
+    },
+    sequence: function(node) {
+      var r = { bits: noBits(), nullable: true, expected: [], exact: true };
+      // Пока элементы могут ничего не поглотить, следующий элемент разбирается с того же байта.
+      for (var i = 0; i < node.elements.length && r.nullable; ++i) {
+        var e = first(node.elements[i]);
+        r = orFirst({ bits: r.bits, nullable: false, expected: r.expected, exact: r.exact }, e);
+      }
+      return r;
+    },
+    action:       function(node) { return first(node.expression); },
+    labeled:      function(node) { return first(node.expression); },
+    text:         function(node) { return first(node.expression); },
+    one_or_more:  function(node) { return first(node.expression); },
+    optional:     function(node) { var r = first(node.expression); return { bits: r.bits, nullable: true, expected: r.expected, exact: r.exact }; },
+    zero_or_more: function(node) { var r = first(node.expression); return { bits: r.bits, nullable: true, expected: r.expected, exact: r.exact }; },
+    range: function(node) {
+      var r = first(node.expression);
+      return node.min ? r : { bits: r.bits, nullable: true, expected: r.expected, exact: r.exact };
+    },
+    // Предикаты разбирают выражение молча и ничего не поглощают.
+    simple_and: function(node) {
+      var r = first(node.expression);
+      return { bits: r.bits, nullable: r.nullable, expected: [], exact: r.exact };
+    },
+    simple_not: function(node) {
+      var r = first(node.expression);
+      return { bits: r.bits, nullable: !r.nullable, expected: [], exact: r.exact };
+    },
+    // Пользовательский код может иметь побочные эффекты, поэтому пропускать его нельзя.
+    semantic_and: inexact,
+    semantic_not: inexact,
+    rule_ref: function(node) {
+      var rule = asts.findRule(ast, node.name);
+      return rule ? first(rule) : inexact();
+    },
+    literal: function(node) {
+      if (node.value.length === 0) {
+        return { bits: noBits(), nullable: true, expected: [], exact: true };
+      }
+      return { bits: classBits([node.value.charAt(0)], false), nullable: false, expected: [literalExpected(node)], exact: true };
+    },
+    "class": function(node) {
+      return { bits: classBits(node.parts, node.inverted), nullable: false, expected: [classExpected(node)], exact: true };
+    },
+    any: inexact,
+  });
+  /// Определяет, можно ли пропускать альтернативу, не пытаясь ее разобрать, если текущий байт
+  /// не входит в ее битовую карту.
+  function isSkippable(a) { return a.exact && !a.nullable; }
+  /// Создает таблицу выбора первой альтернативы по текущему байту.
+  /// @firsts Результаты анализа альтернатив.
+  /// @return Имя таблицы.
+  function addDispatch(firsts) {
+    var name = 'd' + dispatches.length;
+    var table = arrays.map(arrays.range(0, 257), function(ch) {
+      for (var i = 0; i < firsts.length; ++i) {
+        var a = firsts[i];
+        // Конец данных не входит в битовую карту ни одной альтернативы, которую можно пропустить.
+        if (!isSkippable(a) || (ch < 256 && (a.bits[ch >> 3] & (1 << (ch & 7))))) {
+          return i;
+        }
+      }
+      return firsts.length;
+    });
+    // Ожидаемые элементы пропускаемых альтернатив, альтернативы разделяются нулями.
+    var list = [];
+    firsts.forEach(function(a) {
+      if (isSkippable(a)) {
+        list.push.apply(list, a.expected.map(function(e) { return '&' + e; }));
+      }
+      list.push('0');
+    });
+    dispatches.push(
+      'static const struct Expected* const x' + dispatches.length + '[] = { ' + list.join(', ') + ' };',
+      'static const struct Dispatch ' + name + ' = {',
+      '  { ' + table.join(', ') + ' },',
+      '  x' + dispatches.length,
+      '};'
+    );
+    return name;
+  }
+
+  /// Генерирует код узла AST. Результату выражения, подставленного вместо ссылки на правило
+  /// оптимизацией inline-rules, присваивается номер этого правила, как если бы оно было вызвано.
+  function generate(node, context) {
+    var result = generateNode.apply(null, arguments);
+    if (node.inlinedRule !== undefined && !context.skip) {
+      context.pushCode('setKind(' + context.resultStack.top() + ', ' + (asts.indexOfRule(ast, node.inlinedRule) + 1) + ');');
+    }
+    return result;
+  }
+  var generateNode = visitor.build({
     grammar: function(node) {
       node.initializers.forEach(generate);
-      var rules = node.rules.map(function(r) {
-        return generate(r).join('\n')
+      var rules = node.rules.map(function(r, i) {
+        return generate(r, i, false).join('\n')
       });
+      if (options.recognizer) {
+        node.rules.forEach(function(r) { requireSkip(r.name); });
+      }
+      // Функции проверки правил могут потребовать проверки других правил, поэтому список растет.
+      for (var i = 0; i < skipped.length; ++i) {
+        var index = asts.indexOfRule(ast, skipped[i]);
+        // Номера правил в таблице мемоизации не должны пересекаться с номерами функций разбора.
+        rules.push(generate(node.rules[index], node.rules.length + index, true).join('\n'));
+      }
+      var memoized = node.rules.some(function(r) { return utils.isMemoized(r, options); });
 
-      var b = new CodeBuilder([
-        '/*Parser*/',
-        '#include "peg-internal.h"',
-        '',
-      ]);
+      var b = new CodeBuilder(['/*Parser*/']);
+      if (options.threads) {
+        // Параллельный разбор требует pthreads, код пула подключается только по этому макросу.
+        b.push(
+          '#ifndef PEG_THREADS',
+          '#  define PEG_THREADS',
+          '#endif'
+        );
+      }
+      if (options.incremental) {
+        // Отслеживание прочитанных данных нужно только инкрементальному разбору.
+        b.push(
+          '#ifndef PEG_INCREMENTAL',
+          '#  define PEG_INCREMENTAL',
+          '#endif'
+        );
+      }
+      b.push('#include "peg-internal.h"', '');
       // Предварительные объявления функций для вызова пользовательского кода.
       ucb.declares(b);
 
       b.push('/*~~~~~~~~~~~~~~~~~~~~~~ LITERALS ~~~~~~~~~~~~~~~~~~~~~~~*/');
       b.pushAll(literals.vars());
       b.push('/*~~~~~~~~~~~~~~~~~~~~ CHAR CLASSES ~~~~~~~~~~~~~~~~~~~~~*/');
-      // Верхняя половина числа -- количество одиночных символов, нижняя -- количество диапазонов.
-      b.push('#define MAKE_LENGTHS(_1, _2) (((_1) << (sizeof(((struct CharClass*)0)->counts)*4)) | (_2))');
       b.pushAll(charClasses.vars());
-      b.push('#undef MAKE_LENGTHS');
       b.push('/*~~~~~~~~~~~~~~~~ EXPECTED DEFINITIONS ~~~~~~~~~~~~~~~~~*/');
       // Верхние 3 бита числа отводим под тип, остальное -- длина строки.
       b.push('#define MAKE_TYPEANDLEN(type, len) ((type << (sizeof(((struct Expected*)0)->typeAndLen)*8 - 3)) | len)');
       b.pushAll(expected.vars());
       b.push('#undef MAKE_TYPEANDLEN');
+      // Все ожидаемые элементы по их номерам, для построения списка ожидаемых по множеству.
+      b.push(
+        'static const struct Expected* const expecteds[] = { ' + ['&ANY_EXPECTED'].concat(expectedIds.map(function(v, i) { return '&e' + i; })).join(', ') + ' };',
+        '#define EXPECTED_COUNT (sizeof(expecteds) / sizeof(expecteds[0]))'
+      );
+      b.push('/*~~~~~~~~~~~~~~~~~~~ DISPATCH TABLES ~~~~~~~~~~~~~~~~~~~~*/');
+      b.pushAll(dispatches);
+      b.push('/*~~~~~~~~~~~~~~~~~~~~~~ RULE KINDS ~~~~~~~~~~~~~~~~~~~~~~*/');
+      // Имена правил по их номерам, хранящимся в поле kind результатов.
+      b.push('static const char* const kinds[] = { ' + node.rules.map(function(r) { return '"' + r.name + '"'; }).concat(['0']).join(', ') + ' };');
+      // Общая таблица профилирования правил. Контексты ведут счетчики в своих таблицах и переносят
+      // их сюда по окончании разбора (сессии -- при уничтожении).
+      b.push(
+        '#ifdef PEG_PROFILE',
+        'static struct RuleProfile ruleProfiles[' + Math.max(node.rules.length, 1) + '];',
+        'static struct Profile profile = { ' + node.rules.length + ', kinds, ruleProfiles, 0 };',
+        '#endif'
+      );
       b.push('/*~~~~~~~~~~~~~~ RULE FORWARD DECLARATIONS ~~~~~~~~~~~~~~*/');
       b.pushAll(node.rules.map(function(r) { return rDef(r) + ';'; }));
+      b.pushAll(skipped.map(function(n) { return rDef(asts.findRule(ast, n), true) + ';'; }));
       b.push('/*~~~~~~~~~~~~~~~~~~~~~~~~ RULES ~~~~~~~~~~~~~~~~~~~~~~~~*/');
       b.pushAll(rules);
+      b.push('/*~~~~~~~~~~~~~~~~~~~~~~~~ LOOKUP ~~~~~~~~~~~~~~~~~~~~~~~*/');
+      // Таблицы для поиска правил разбора по имени.
+      var ruleNames = node.rules.map(function(r) { return r.name; });
+      b.pushAll(createLookupTable(ruleNames, false));
+      if (options.recognizer) {
+        b.pushAll(createLookupTable(ruleNames, true));
+      }
       b.push('/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/');
-      b.indent('PARSER_API struct Result* parse(struct Range* input, struct Range* startRule, void* data) {');
-      // Создаем таблицу для поиска правил разбора по имени.
-      b.pushAll(createLookupTable(node.rules.map(function(r) { return r.name; })));
-      b.push(
-        'struct Context ctx = {',
-        '  { 0, 0 },',// Range
-        '  { 0, 0, 1, 1 },',// Location
-        '  { 0, { 0, 0, 1, 1 }, 0, 0 },',// FailInfo
-        '  0, 0',// FreeUserDataFunc и data
-        '};',
-        'ctx.input.begin = input->begin;',
-        'ctx.input.end = input->end;',
-        'ctx.current.data = input->begin;',
-        'ctx.userData = data;',
-        'if (startRule) {',
-        '  const struct ParseFunc* func = findRule(funcs, sizeof(funcs) / sizeof(funcs[0]), startRule);',
-        '  if (func == 0) { return 0; }',
-        '  return (*func->func)(&ctx);',
-        '}',
-        'return ' + (node.rules.length > 0 ? (r(node.rules[0].name) + '(&ctx)') : '0')+ ';'
-      );
+      if (memoized) {
+        // Размер таблицы мемоизации можно переопределить при компиляции парсера.
+        b.push(
+          '#ifndef PEG_MEMO_LIMIT',
+          '#  define PEG_MEMO_LIMIT ' + (options.memoLimit || 4 * 1024 * 1024) + 'ul',
+          '#endif'
+        );
+      }
+      /// Генерирует поиск функции разбора стартового правила `startRule` в переменной `func` для
+      /// функций параллельного разбора.
+      /// @defaultRule Имя правила, разбираемого, если `startRule` не передано, или `null`.
+      function pushFindFunc(defaultRule) {
+        b.push(
+          '  RuleFunc func = ' + (defaultRule ? '&' + r(defaultRule) : '0') + ';',
+          '  if (startRule) {',
+          '    const struct ParseFunc* f = findRule(funcs, sizeof(funcs) / sizeof(funcs[0]), startRule);',
+          '    if (f == 0) { return E_BATCH_NO_RULE; }',
+          '    func = f->func;',
+          '  }',
+          '  if (func == 0) { return E_BATCH_NO_RULE; }'
+        );
+      }
+      /// Генерирует начало функции разбора: таблицу правил, контекст и вызов стартового правила.
+      /// @skip Если `true`, используются функции проверки правил без построения результата.
+      /// @error Значение, возвращаемое, если стартовое правило не найдено.
+      /// @type Тип результата вызова, помещаемого в переменную `result`.
+      /// @call Код вызова стартового правила, функция которого находится в переменной `func`.
+      /// @setup Необязательный массив операторов, выполняемых перед заполнением контекста.
+      function pushParseCall(skip, error, type, call, setup) {
+        var funcs = skip ? 'skipFuncs' : 'funcs';
+        b.push(
+          'struct Context ctx = {',
+          '  { 0, 0 },',// Range
+          '  0,',// current
+          '  { 0, { 0, 0, 1, 1 }, 0, 0, 0 },',// FailInfo
+          '  { 0, 0, 0 },',// ExpectedSet
+          '  0, 0,',// FreeUserDataFunc и data
+          '  { 0, 0, 0, 0 },',// Memo
+          '  0, 0, 0, 0',// Arena, Stream, examined и failed
+          '#ifdef PEG_PROFILE',
+          '  , 0, 0',// Profile и ProfileFrame
+          '#endif',
+          '};',
+          // Множество ожидаемых элементов имеет фиксированный размер и не требует выделения памяти.
+          'unsigned long expectedBits[EXPECTED_WORDS(EXPECTED_COUNT)];',
+          'RuleFunc func = ' + (node.rules.length > 0 ? '&' + r(node.rules[0].name, skip) : '0') + ';',
+          type + ' result;',
+          // Счетчики одного разбора переносятся в общую таблицу по его окончании, поэтому
+          // одновременные разборы в разных потоках не пишут в общую таблицу.
+          '#ifdef PEG_PROFILE',
+          'struct RuleProfile callRules[' + Math.max(node.rules.length, 1) + '];',
+          'struct Profile callProfile;',
+          '#endif'
+        );
+        b.pushAll(setup || []);
+        b.push(
+          '#ifdef PEG_PROFILE',
+          'initProfile(&callProfile, callRules, &profile);',
+          'ctx.profile = &callProfile;',
+          '#endif'
+        );
+        b.push(
+          'initExpected(&ctx, expecteds, EXPECTED_COUNT, expectedBits);',
+          'ctx.input.begin = input->begin;',
+          'ctx.input.end = input->end;',
+          'ctx.failInfo.pos.data = input->begin;',
+          'ctx.userData = data;'
+        );
+        b.push(
+          'if (startRule) {',
+          '  const struct ParseFunc* f = findRule(' + funcs + ', sizeof(' + funcs + ') / sizeof(' + funcs + '[0]), startRule);',
+          '  if (f == 0) { return ' + error + '; }',
+          '  func = f->func;',
+          '}',
+          'if (func == 0) { return ' + error + '; }'
+        );
+        if (memoized) {
+          b.push('initMemo(&ctx, PEG_MEMO_LIMIT);');
+        }
+        b.push(
+          'result = ' + call + ';',
+          '#ifdef PEG_PROFILE',
+          'flushProfile(&callProfile);',
+          '#endif'
+        );
+        if (memoized) {
+          // Результаты, попавшие в итоговое дерево, переживут таблицу благодаря счетчику ссылок.
+          b.push('freeMemo(&ctx);');
+        }
+      }
+      if (options.arena) {
+        // Результаты размещаются в арене, переданной вызывающим, и освобождаются вместе с ней.
+        // Если арена не передана, узлы выделяются в куче, как и без этой опции.
+        b.indent('PARSER_API struct Result* parseArena(struct Arena* arena, struct Range* input, struct Range* startRule, void* data) {');
+      } else {
+        b.indent('PARSER_API struct Result* parse(struct Range* input, struct Range* startRule, void* data) {');
+      }
+      pushParseCall(false, '0', 'struct Result*', '(*func)(&ctx)', options.arena ? ['ctx.arena = arena;'] : []);
+      b.push('return result;');
       b.dedent('}');
+      if (options.recognizer) {
+        // Проверка входных данных без построения дерева: узлы результата не выделяются вовсе.
+        b.indent('PARSER_API int recognize(struct Range* input, struct Range* startRule, void* data, unsigned int* end, struct FailInfo* failInfo) {');
+        pushParseCall(true, '-1', 'struct Result*', '(*func)(&ctx)');
+        b.push(
+          'if (end) { *end = ctx.current; }',
+          // Список ожидаемых элементов строится, только если информация об ошибке запрошена.
+          'if (failInfo) {',
+          '  collectExpected(&ctx);',
+          '  memcpy(failInfo, &ctx.failInfo, sizeof(struct FailInfo));',
+          '}',
+          'return !isFailed(result);'
+        );
+        b.dedent('}');
+      }
+      if (options.flat) {
+        // Дерево строится в арене и сразу переносится в плоский массив узлов. Неизвестное стартовое
+        // правило -- такая же неудача, как и неудачный разбор: дерево пусто, результат 0.
+        b.indent('PARSER_API int parseFlat(struct Range* input, struct Range* startRule, void* data, struct FlatTree* tree) {');
+        pushParseCall(false, '0', 'int', 'parseFlatTree(&ctx, func, tree)', [
+          'tree->count = 0;',
+          'tree->nodes = 0;',
+        ]);
+        b.push('return result;');
+        b.dedent('}');
+      }
+      // Если стартовое правило -- повторение другого правила (`start = record*`), то записями
+      // по умолчанию считаются результаты повторяемого правила: потоковый разбор фиксируется
+      // после каждого из них, а параллельный делит данные между ними.
+      var recordRef  = utils.recordRef(node);
+      var recordRule = recordRef ? recordRef.name : null;
+      if (options.stream) {
+        // Записи разбираются по одной из окна, которое дочитывается из потока по мере надобности.
+        b.indent('PARSER_API int parseStream(struct Stream* stream, struct Range* startRule, RecordFunc onRecord, void* data) {');
+        b.push(
+          'struct Range window;',
+          'struct Range* input = &window;'
+        );
+        var record = recordRule ? ['func = &' + r(recordRule) + ';'] : [];
+        pushParseCall(false, 'E_STREAM_NO_RULE', 'int', 'parseRecords(&ctx, func, onRecord, data)', record.concat([
+          // Окно изначально пусто и заполняется при первом обращении к данным.
+          'window.begin = stream->buffer;',
+          'window.end   = stream->buffer;',
+          'ctx.stream = stream;',
+        ]));
+        b.push(
+          'if (result == E_STREAM_FAILED) { collectExpected(&ctx); }',
+          'memcpy(&stream->failInfo, &ctx.failInfo, sizeof(struct FailInfo));',
+          'return result;'
+        );
+        b.dedent('}');
+      }
+      if (options.session || options.threads || options.incremental) {
+        // Контекст, арена и таблица мемоизации сессии создаются один раз, стартовое правило
+        // ищется только при его смене, поэтому каждый разбор начинается почти без подготовки.
+        b.push(
+          'PARSER_API struct Session* createSession(void* data) {',
+          '  struct Session* s = newSession(' + (node.rules.length > 0 ? '&' + r(node.rules[0].name) : '0') + ', data, ' + (memoized ? 'PEG_MEMO_LIMIT' : '0') + ', expecteds, EXPECTED_COUNT);',
+          '#ifdef PEG_PROFILE',
+          '  if (s && (s->context.profile = newProfile(&profile)) == 0) {',
+          '    destroySession(s);',
+          '    return 0;',
+          '  }',
+          '#endif',
+          '  return s;',
+          '}',
+          'PARSER_API int setStartRule(struct Session* session, struct Range* startRule) {',
+          '  const struct ParseFunc* f = findRule(funcs, sizeof(funcs) / sizeof(funcs[0]), startRule);',
+          '  if (f == 0) { return 0; }',
+          '  session->func = f->func;',
+          '  return 1;',
+          '}'
+        );
+      }
+      if (options.incremental) {
+        // Документ хранит данные и результаты разбора всех правил между правками.
+        b.push(
+          'PARSER_API struct Document* createDocument(const char* input, unsigned int len, void* data) {',
+          '  return newDocument(createSession(data), input, len);',
+          '}'
+        );
+      }
+      if (options.threads) {
+        // Независимые входные данные разбираются пулом потоков, у каждого потока своя сессия.
+        b.push('PARSER_API int parseBatch(const struct Range* inputs, unsigned int count, struct Range* startRule, unsigned int threads, BatchFunc onResult, void* data) {');
+        pushFindFunc(node.rules.length > 0 ? node.rules[0].name : null);
+        b.push(
+          '  return runBatch(&createSession, func, threads, inputs, count, onResult, data);',
+          '}'
+        );
+        // Одни большие данные делятся на части по записям, части разбираются параллельно.
+        b.push('PARSER_API int parseChunked(struct Range* input, struct Range* startRule, unsigned int threads, RecordFunc onRecord, void* data, struct FailInfo* failInfo) {');
+        pushFindFunc(recordRule || (node.rules.length > 0 ? node.rules[0].name : null));
+        b.push(
+          '  return runChunked(&createSession, func, threads, input, onRecord, data, failInfo);',
+          '}'
+        );
+      }
+      if (options.arena) {
+        b.push(
+          'PARSER_API struct Result* parse(struct Range* input, struct Range* startRule, void* data) {',
+          '  return parseArena(0, input, startRule, data);',
+          '}'
+        );
+      }
       b.push(
+        '#ifdef PEG_PROFILE',
+        'PARSER_API struct Profile* getProfile(void) {',
+        '  return &profile;',
+        '}',
+        '#endif',
+        'PARSER_API const char* kindName(unsigned int kind) {',
+        '  return kind > 0 && kind <= ' + node.rules.length + ' ? kinds[kind - 1] : 0;',
+        '}',
         'PARSER_API struct Result* parse2(const char* input, unsigned int len, struct Range* startRule, void* data) {',
         '  struct Range r;',
         '  r.begin = input;',
@@ -500,60 +1048,152 @@ function generateCCode(ast, options) {
       ucb.addInitializer(node.namespace, node.code);
     },
 
-    rule: function(node) {
+    rule: function(node, index, skip) {
       var code = [
-        rDef(node) + ' {',
+        rDef(node, skip) + ' {',
         '  ',// зарезервировано для переменных из стека результатов
         '  ',// зарезервировано для переменных из стека позиций
         '',
       ];
-      var context = makeContext(code);
+      var context = makeContext(code, hasUserCode(node)).child(-1, {}, null, skip);
+      var memoized = utils.isMemoized(node, options);
+      // Функции разбора и проверки правила учитываются в одних и тех же счетчиках.
+      var ruleIndex = skip ? index - ast.rules.length : index;
       context.indent();
+      context.pushCode('PEG_PROFILE_ENTER(ctx, ' + ruleIndex + ');');
+      if (memoized) {
+        var hit = context.resultStack.result();
+        // Начальная позиция правила нужна, чтобы запомнить результат после разбора.
+        context.pushCode(
+          'if (recallMemo(ctx, ' + index + ', &' + hit + ')) { PEG_PROFILE_MEMO(ctx, 1); PEG_PROFILE_LEAVE(ctx, ' + hit + '); return ' + hit + '; }',
+          'PEG_PROFILE_MEMO(ctx, 0);',
+          context.pushPos(true)
+        );
+        if (options.incremental) {
+          // Правило отслеживает прочитанные им данные и сообщенные неудачи отдельно от вызвавшего
+          // его правила.
+          context.pushCode(
+            context.posStack.push('ctx->examined') + ' ctx->examined = ctx->current;',
+            context.posStack.push('ctx->failed') + ' ctx->failed = 0;'
+          );
+        }
+      }
       generate(node.expression, context);
+      if (!skip) {
+        context.pushCode('setKind(' + context.resultStack.result() + ', ' + (index + 1) + ');');
+      }
+      if (memoized) {
+        var outerFailed = options.incremental ? context.posStack.pop() : null;
+        var outer = options.incremental ? context.posStack.pop() : null;
+        context.pushCode(
+          'rememberMemo(ctx, ' + index + ', ' + context.dropPos(true) + ', ' + context.resultStack.result() + ');'
+        );
+        if (outer) {
+          context.pushCode(
+            'if (ctx->examined < ' + outer + ') { ctx->examined = ' + outer + '; }',
+            'if (ctx->failed < ' + outerFailed + ') { ctx->failed = ' + outerFailed + '; }'
+          );
+        }
+      }
+      context.pushCode('PEG_PROFILE_LEAVE(ctx, ' + context.resultStack.result() + ');');
       context.dedent(
         '  return ' + context.resultStack.result() + ';',
         '}'
       );
       code[1] += context.resultStack.vars();
       code[2] += context.posStack.vars();
+      if (useArena && context.markStack.maxSp >= 0) {
+        code[2] += ' ' + context.markStack.vars();
+      }
+      if (context.countStack.maxSp >= 0) {
+        code[2] += ' ' + context.countStack.vars();
+      }
       return code;
     },
 
     named: function(node, context) {
-      var e = expected.add('OTHER', null, node.name);
+      var e = namedExpected(node);
 
       context.pushCode('++ctx->failInfo.silent;');
       generate(node.expression, context),
       context.pushCode(
         '--ctx->failInfo.silent;',
         'if (isFailed(' + context.resultStack.top() + ')) {',
-        '  ' + context.resultStack.push('fail(ctx, &' + e + ')'),
+        '  ' + context.resultStack.replace('fail(ctx, &' + e + ')'),
         '}'
       );
     },
 
     choice: function(node, context) {
+      var firsts = options.dispatch === false ? [] : node.alternatives.map(first);
+      // Выбор по первому байту имеет смысл, только если хоть одну альтернативу можно пропустить.
+      var dispatch = firsts.some(isSkippable) && firsts.length < 255;
+
       context.indent('do {/*choice*/');
+      if (dispatch) {
+        // Переходим сразу к первой альтернативе, которая может начаться с текущего байта. Остальные
+        // альтернативы пропускаются по проверке байта, если их битовые карты с ним не пересекаются.
+        context.indent('switch (dispatch(ctx, &' + addDispatch(firsts) + ')) {');
+      }
       node.alternatives.forEach(function(n, i, a) {
+        if (dispatch) {
+          if (i > 0) {
+            context.dedent();
+          }
+          context.indent('case ' + i + ':');
+        }
         context.pushCode('/*alternative ' + (i+1) + '*/');
+        var guard = dispatch && isSkippable(firsts[i]);
+        if (guard) {
+          // Имя переменной, в которую альтернатива поместит свой результат.
+          var f = context.resultStack.push('&FAILED');
+          context.resultStack.pop();
+          context.pushCode('if (!matchCharClass(ctx, &' + charClasses.add(firsts[i].bits) + ')) {');
+          context.pushCode.apply(context, firsts[i].expected.map(function(e) { return '  fail(ctx, &' + e + ');'; }));
+          context.pushCode('  ' + f);
+          context.indent('} else {');
+        }
         // Для каждой альтернативы набор переменных свой
         generate(n, context.child(context.sp, objects.clone(context.env), null));
+        if (guard) {
+          context.dedent('}');
+        }
         // Если элемент не последний в массиве, то генерируем проверку
         if (i+1 < a.length) {
-          context.pushCode('if (!isFailed(' + context.resultStack.pop() + ')) { break; }', '');
+          context.pushCode('if (!isFailed(' + context.resultStack.pop() + ')) { break; }', dispatch ? '/* fall through */' : '');
         }
       });
+      if (dispatch) {
+        // Если ни одна альтернатива не может начаться с текущего байта, обо всех уже сообщено.
+        var none = context.resultStack.replace('&FAILED');
+        context.pushCode('break;');
+        context.dedent('default:');
+        context.pushCode('  ' + none);
+        context.dedent('}');
+      }
       context.dedent('} while (0);/*choice*/');
     },
 
     sequence: function(node, context) {
+      /// Определяет, можно ли разобрать элемент последовательности без построения результата.
+      /// Помеченные элементы строятся, если их значения доступны пользовательскому коду, а
+      /// непомеченные элементы последовательности с действием -- если не задана опция
+      /// `elideUnlabeled`.
+      function skipElement(n) {
+        if (n.type === 'labeled') {
+          return context.skip && !context.keepLabels;
+        }
+        return context.skip || !!(options.elideUnlabeled && context.action);
+      }
+      var built = node.elements.map(function(n) { return n.type === 'labeled' && !skipElement(n); });
+
       context.pushCode(context.pushPos());
       context.indent('do {/*sequence*/');
       var first;
       node.elements.forEach(function(n, i) {
         context.pushCode('/*element ' + (i+1) + '*/');
         // Для всех элементов последовательности набор переменных одинаковый.
-        generate(n, context.child(context.sp + i, context.env, null));
+        generate(n, context.child(context.sp + i, context.env, null, skipElement(n)));
         if (i === 0) {
           first = context.resultStack.top();
         }
@@ -566,7 +1206,7 @@ function generateCCode(ast, options) {
           context.resultStack.range(context.sp + 1).reverse().map(function(r) { return '  freeResult(' + r + ');'; })
         );
         context.pushCode(
-          '  memcpy(&ctx->current, &' + context.posStack.top() + ', sizeof(struct Location));',
+          '  ' + context.restorePos(),
           '  ' + first + ' = &FAILED;',
           '  break;',
           '}',
@@ -575,7 +1215,6 @@ function generateCCode(ast, options) {
       });
       var args = context.resultStack.args(context.env);
       var elems = context.resultStack.pop(node.elements.length);
-      var beginPos = context.posStack.pop();
       if (context.action) {
         context.pushCode(ucb.addAction(
           context.action.namespace,
@@ -583,9 +1222,19 @@ function generateCCode(ast, options) {
           context.action.code,
           args
         ) + ';');
-      }/* else */{// TODO: На данный момент изменение возвращаемого значения действиями не поддерживается.
-        elems.unshift('ctx', beginPos + '.offset', elems.length);
-        context.pushCode(context.resultStack.push('wrap(' + elems.join(', ') + ')')); 
+      }
+      if (context.skip) {
+        // Построенные помеченные элементы больше не нужны.
+        var freed = elems.filter(function(e, i) { return built[i]; });
+        context.pushCode.apply(context, freed.reverse().map(function(r) { return 'freeResult(' + r + ');'; }));
+        if (useArena && freed.length > 0) {
+          context.pushCode(context.rewind());
+        }
+        context.dropPos();
+        context.pushCode(context.resultStack.push('&NIL'));
+      } else {// TODO: На данный момент изменение возвращаемого значения действиями не поддерживается.
+        elems.unshift('ctx', context.dropPos(), elems.length);
+        context.pushCode(context.resultStack.push('wrap(' + elems.join(', ') + ')'));
       }
       context.dedent('} while (0);/*sequence*/');
     },
@@ -597,12 +1246,19 @@ function generateCCode(ast, options) {
     },
 
     text: function(node, context) {
-      context.pushCode(context.pushPos());
-      // Внутри $ новый scope переменных.
-      generate(node.expression, context.child(context.sp + 1, objects.clone(context.env), null));
+      // Внутри $ новый scope переменных. Результат разбора выражения не нужен, поэтому оно
+      // только проверяется, а текст создается по границам разобранного участка.
+      var inner = context.child(context.sp, objects.clone(context.env), null, true);
+      if (context.skip) {
+        generate(node.expression, inner);
+        return;
+      }
+      // Внутри ничего не выделяется, поэтому отметка арены не нужна.
+      context.pushCode(context.pushPos(true));
+      generate(node.expression, inner);
       context.pushCode(
         'if (!isFailed(' + context.resultStack.pop() + ')) {',
-        '  ' + context.resultStack.push('_text(ctx, ' + context.posStack.pop() + ')'),
+        '  ' + context.resultStack.push('_text(ctx, ' + context.dropPos(true) + ')'),
         '}'
       );
     },
@@ -627,11 +1283,11 @@ function generateCCode(ast, options) {
     },
 
     simple_and: function(node, context) {
-      return buildSimplePredicate(node.expression, false, context);
+      return generateSimplePredicate(node.expression, false, context);
     },
 
     simple_not: function(node, context) {
-      return buildSimplePredicate(node.expression, true, context);
+      return generateSimplePredicate(node.expression, true, context);
     },
 
     semantic_and: function(node, context) {
@@ -649,27 +1305,39 @@ function generateCCode(ast, options) {
       // генерировать не надо.
       var emitCall = node.expression.type !== "sequence";
 
-      // Если вызов генерируется, нужно сохранить позицию перед выполнением пользовательского кода,
-      // чтобы он имел к ней доступ.
-      if (emitCall) {
-        context.pushCode(context.pushPos());
+      // Помеченное выражение строится и в режиме пропуска: его значение передается в действие.
+      var built = node.expression.type === 'labeled' && context.keepLabels;
+      // Отметка арены нужна, только чтобы освободить такое выражение после действия.
+      var mark = emitCall && context.skip && built && useArena;
+
+      if (mark) {
+        context.pushCode(context.pushMark());
       }
-      generate(node.expression, context.child(context.sp, env, node));
+      generate(node.expression, context.child(context.sp, env, node, context.skip && !built));
       if (emitCall) {
         var params = objects.keys(env);
         var args = context.resultStack.args(env);
         context.pushCode(
           'if (!isFailed(' + context.resultStack.top() + ')) {',
-          '  ' + ucb.addAction(node.namespace, params, node.code, args) + ';',
-          '}'
+          '  ' + ucb.addAction(node.namespace, params, node.code, args) + ';'
         );
-        context.popPos();
+        if (context.skip && built) {
+          context.pushCode('  freeResult(' + context.resultStack.top() + ');');
+          if (mark) {
+            context.pushCode('  ' + context.rewind());
+          }
+          context.pushCode('  ' + context.resultStack.top() + ' = &NIL;');
+        }
+        context.pushCode('}');
+      }
+      if (mark) {
+        context.dropMark();
       }
     },
 
     rule_ref: function(node, context) {
       // Помещаем результат разбора правила на вершину стека результатов.
-      context.pushCode(context.resultStack.push(r(node.name) + '(ctx)'));
+      context.pushCode(context.resultStack.push((context.skip ? requireSkip(node.name) : r(node.name)) + '(ctx)'));
     },
 
     literal: function(node, context) {
@@ -680,30 +1348,21 @@ function generateCCode(ast, options) {
         emitWarning("Unicode symbols not supported", node.value, node.region);
       }
       var v = literals.add(node.value);
-      var e = expected.add(
-        'LITERAL',
-        node.ignoreCase ? node.value.toLowerCase() : node.value,
-        '"' + escape(node.value) + '"'
-      );
+      var e = literalExpected(node);
       // Помещаем результат разбора класса символов на вершину стека результатов.
-      context.pushCode(context.resultStack.push('parseLiteral(ctx, &' + v + ', &' + e + ')'));
+      context.pushCode(context.resultStack.push((context.skip ? 'skipLiteral' : 'parseLiteral') + '(ctx, &' + v + ', &' + e + ')'));
     },
 
     "class": function(node, context) {
-      if (node.ignoreCase) {
-        emitWarning("Case insensitive matching not supported", node.rawText, node.region);
-      }
-      var v = charClasses.add(node.parts);
-      var e = expected.add('CLASS', node.rawText, node.rawText);
       // Помещаем результат разбора класса символов на вершину стека результатов.
       context.pushCode(context.resultStack.push(
-        'parseCharClass(ctx, &' + v + ', &' + e + ', ' + (node.inverted ? '1' : '0')+ ')'
+        (context.skip ? 'skipCharClass' : 'parseCharClass') + '(ctx, &' + classConstant(node) + ', &' + classExpected(node) + ')'
       ));
     },
 
     any: function(node, context) {
       // Помещаем результат разбора any на вершину стека результатов.
-      context.pushCode(context.resultStack.push('parseAny(ctx)'));
+      context.pushCode(context.resultStack.push(context.skip ? 'skipAny(ctx)' : 'parseAny(ctx)'));
     }
   });
 
@@ -0,0 +1,82 @@
+var asts  = require("pegjs/lib/compiler/asts"),
+    utils = require("../ast-utils");
+
+/// Максимальное количество узлов в выражении правила, которое подставляется вместо ссылок на него.
+var MAX_SIZE = 8;
+
+/// Подставляет выражения небольших нерекурсивных правил вместо ссылок на них, избавляя от вызова
+/// функции правила. Сами правила остаются, так что их можно использовать как стартовые. Результату
+/// подставленного выражения генератор присваивает номер правила (поле `inlinedRule`), так что
+/// дерево разбора не меняется. Не подставляются правила:
+/// - с пользовательским кодом и метками, которые зависят от окружения, в котором находятся;
+/// - с мемоизацией (при инкрементальном разборе -- все), которая работает только для функций правил;
+/// - повторяемое стартовым правилом вида `start = record*` или `start = record+` при потоковом
+///   и параллельном разборе, так как оно определяет записи потока и границы частей данных.
+function inlineRules(ast, options) {
+  function hasContext(node) {
+    return node.type === 'action' || node.type === 'labeled'
+      || node.type === 'semantic_and' || node.type === 'semantic_not';
+  }
+  /// Определяет, может ли правило через цепочку ссылок вызвать само себя.
+  function isRecursive(rule) {
+    var visited = {};
+    function reaches(node) {
+      return utils.contains(node, function(n) {
+        if (n.type !== 'rule_ref') {
+          return false;
+        }
+        if (n.name === rule.name) {
+          return true;
+        }
+        if (visited[n.name]) {
+          return false;
+        }
+        visited[n.name] = true;
+        var r = asts.findRule(ast, n.name);
+        return r ? reaches(r.expression) : false;
+      });
+    }
+    return reaches(rule.expression);
+  }
+
+  var record = options.stream || options.threads ? utils.recordRef(ast) : null;
+  /// Правила, подстановка которых уже выполнена внутри них самих, по именам.
+  var done = {};
+  function process(rule) {
+    if (!done[rule.name]) {
+      done[rule.name] = true;
+      rule.expression = inline(rule.expression);
+    }
+    return rule;
+  }
+  function inline(node) {
+    if (node.type === 'rule_ref' && node !== record) {
+      var rule = asts.findRule(ast, node.name);
+      if (rule && !utils.isMemoized(rule, options) && !isRecursive(rule) && !utils.contains(rule.expression, hasContext)) {
+        var expression = process(rule).expression;
+        if (utils.size(expression) <= MAX_SIZE) {
+          var copy = utils.clone(expression);
+          // Если выражение само подставлено из другого правила, номер остается у самого вложенного.
+          if (copy.inlinedRule === undefined) {
+            copy.inlinedRule = rule.name;
+          }
+          return copy;
+        }
+      }
+      return node;
+    }
+    if (node.expression) {
+      node.expression = inline(node.expression);
+    }
+    if (node.elements) {
+      node.elements = node.elements.map(inline);
+    }
+    if (node.alternatives) {
+      node.alternatives = node.alternatives.map(inline);
+    }
+    return node;
+  }
+  ast.rules.forEach(process);
+}
+
+module.exports = inlineRules;
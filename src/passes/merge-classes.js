@@ -0,0 +1,46 @@
+var utils = require("../ast-utils");
+
+/// Объединяет идущие подряд альтернативы выбора, каждая из которых -- класс символов или литерал
+/// из одного символа, в один класс (`[a-z] / "_"` -> `[_a-z]`). Все такие альтернативы поглощают
+/// ровно один байт и дают одинаковый результат, поэтому порядок их проверки не важен. Исключение --
+/// подставленные правила, результат которых отличается номером правила: они объединяются только
+/// там, где результат отбрасывается.
+function mergeClasses(ast) {
+  utils.transform(ast, function(node, unobserved) {
+    if (node.type !== 'choice') {
+      return node;
+    }
+    var alternatives = [];
+    /// Байты класса, накапливаемого из текущей серии альтернатив, и количество альтернатив в ней.
+    var bytes = null, count = 0;
+    function flush() {
+      if (count > 1) {
+        alternatives[alternatives.length - 1] = utils.classOf(bytes, alternatives[alternatives.length - 1].region);
+      }
+      bytes = null;
+      count = 0;
+    }
+    node.alternatives.forEach(function(a) {
+      var b = unobserved || a.inlinedRule === undefined ? utils.bytesOf(a) : null;
+      if (b === null) {
+        flush();
+        alternatives.push(a);
+      } else if (bytes === null) {
+        bytes = b;
+        count = 1;
+        alternatives.push(a);
+      } else {
+        bytes = bytes.map(function(v, i) { return v || b[i]; });
+        ++count;
+      }
+    });
+    flush();
+    if (alternatives.length === 1) {
+      return alternatives[0];
+    }
+    node.alternatives = alternatives;
+    return node;
+  });
+}
+
+module.exports = mergeClasses;
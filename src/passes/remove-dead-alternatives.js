@@ -0,0 +1,64 @@
+var utils = require("../ast-utils");
+
+/// Удаляет альтернативы выбора, которые никогда не будут успешно разобраны:
+/// - альтернативы, которые неудачны при любых входных данных (например, пустой класс `[]`);
+/// - альтернативы после альтернативы, которая успешна при любых входных данных (`a? / b`);
+/// - литералы и классы, которые могли бы быть успешно разобраны только там, где успешна одна из
+///   предыдущих альтернатив-литералов или классов (`"a" / "ab"`, `[a-z] / "x"`).
+/// Альтернативы с пользовательским кодом (в том числе в правилах, на которые они ссылаются) не
+/// удаляются никогда: код мог выполняться и при неудачном разборе альтернативы.
+/// Если не остается ни одной альтернативы, выбор не меняется.
+function removeDeadAlternatives(ast) {
+  utils.transform(ast, function(node) {
+    if (node.type !== 'choice') {
+      return node;
+    }
+    var alternatives = [];
+    /// Байты, с которых успешно разбирается одна из предыдущих альтернатив-классов, и предыдущие
+    /// альтернативы-литералы.
+    var covered = [], literals = [];
+    /// Истинно после альтернативы, которая успешна при любых входных данных.
+    var unreachable = false;
+    for (var i = 0; i < node.alternatives.length; ++i) {
+      var a = node.alternatives[i];
+      var bytes = utils.bytesOf(a);
+      var plain = a.type === 'literal' && !a.ignoreCase;
+      if (utils.hasUserCode(ast, a)) {
+        alternatives.push(a);
+        unreachable = unreachable || utils.alwaysMatches(ast, a);
+        continue;
+      }
+      if (unreachable || utils.neverMatches(ast, a)) {
+        continue;
+      }
+      if (bytes !== null && bytes.every(function(v, ch) { return !v || covered[ch]; })) {
+        continue;
+      }
+      if (plain && a.value.length > 0 && (covered[a.value.charCodeAt(0)] || literals.some(function(l) {
+        return a.value.substr(0, l.length) === l;
+      }))) {
+        continue;
+      }
+      alternatives.push(a);
+      if (utils.alwaysMatches(ast, a)) {
+        unreachable = true;
+        continue;
+      }
+      if (bytes !== null) {
+        bytes.forEach(function(v, ch) { covered[ch] = covered[ch] || v; });
+      } else if (plain) {
+        literals.push(a.value);
+      }
+    }
+    if (alternatives.length === 0) {
+      return node;
+    }
+    if (alternatives.length === 1) {
+      return alternatives[0];
+    }
+    node.alternatives = alternatives;
+    return node;
+  });
+}
+
+module.exports = removeDeadAlternatives;